@@ -3,11 +3,94 @@
 // Implements the Conditioning class
 #include "conditioning.h"
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <functional>
+#include <set>
+
+#include "cyder_trace.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+#ifdef CYDER_SHADOW
+const bool kShadowBuild = true;
+#else
+const bool kShadowBuild = false;
+#endif
+
+/// @brief wall-clock seconds elapsed since start
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/// the largest inventory_nuclides, as given by its range
+const int kMaxInventoryNuclides = 100;
+
+/// @brief whether two running totals of mass agree to within eps_rsrc per
+/// kilogram of the larger one. Each update of a total rounds relative to its
+/// magnitude, so an absolute tolerance fails for large inventories.
+bool TotalsAgree(double a, double b) {
+  double scale = std::max(1.0, std::max(std::abs(a), std::abs(b)));
+  return std::abs(a - b) <= cyclus::eps_rsrc() * scale;
+}
+
+/// @brief the id of a material's composition, or 0 under lazy decay, where
+/// reading the composition would decay the material
+int CompId(cyclus::Material::Ptr mat, bool lazy) {
+  return lazy ? 0 : mat->comp()->id();
+}
+
+/// @brief reads a field of the first row of a query into val, leaving val at
+/// its default when the field is missing. Databases written by earlier
+/// versions of this archetype lack the fields of newer state variables.
+template <class T>
+void GetValOrDefault(cyclus::QueryResult& qr, const char* field, T* val) {
+  try {
+    *val = qr.GetVal<T>(field);
+  } catch (cyclus::KeyError& e) {
+    // not written by that version
+  }
+}
+
+}  // namespace
+
 namespace conditioning {
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 Conditioning::Conditioning(cyclus::Context* ctx) 
     : cyclus::Facility(ctx),
+      // state variables start at their pragma defaults, for agents that are
+      // not built from an input file (tests and benchmarks)
+      residence_time(0),
+      throughput(1e299),
+      max_inv_size(1e299),
+      processing_throughput(1e299),
+      packaging_throughput(1e299),
+      discrete_handling(false),
+      package_capacity(0),
+      package_fill(false),
+      discrete_fill(false),
+      dense_blend(false),
+      decay_on_ready(false),
+      release_order("fifo"),
+      bulk_receive(false),
+      consolidate(false),
+      cache_requests(false),
+      trace_counters(false),
+      record_stats(false),
+      record_inventory(false),
+      inventory_nuclides(0),
+      shadow(false),
+      tick_time(0),
+      process_time(0),
+      producer_capacity(0),
+      defer_output_(false),
+      next_due(0),
+      shadow_diverged(false),
       latitude(0.0),
       longitude(0.0),
       coordinates(latitude, longitude) {
@@ -21,14 +104,8 @@ Conditioning::Conditioning(cyclus::Context* ctx)
 
 #pragma cyclus def annotations conditioning::Conditioning
 
-#pragma cyclus def initinv conditioning::Conditioning
-
-#pragma cyclus def snapshotinv conditioning::Conditioning
-
 #pragma cyclus def infiletodb conditioning::Conditioning
 
-#pragma cyclus def snapshot conditioning::Conditioning
-
 #pragma cyclus def clone conditioning::Conditioning
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -39,17 +116,338 @@ void Conditioning::InitFrom(Conditioning* m) {
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 void Conditioning::InitFrom(cyclus::QueryableBackend* b) {
-#pragma cyclus impl initfromdb conditioning::Conditioning
+  // read by hand rather than through the generated initfromdb, which throws
+  // on the columns that databases from earlier versions lack. Those state
+  // variables keep the defaults the constructor gave them.
+  cyclus::Facility::InitFrom(b);
+  cyclus::QueryResult qr = b->Query("Info", NULL);
+  in_commods = qr.GetVal<std::vector<std::string> >("in_commods");
+  in_commod_prefs = qr.GetVal<std::vector<double> >("in_commod_prefs");
+  out_commods = qr.GetVal<std::vector<std::string> >("out_commods");
+  in_recipe = qr.GetVal<std::string>("in_recipe");
+  residence_time = qr.GetVal<int>("residence_time");
+  throughput = qr.GetVal<double>("throughput");
+  max_inv_size = qr.GetVal<double>("max_inv_size");
+  discrete_handling = qr.GetVal<bool>("discrete_handling");
+  latitude = qr.GetVal<double>("latitude");
+  longitude = qr.GetVal<double>("longitude");
+
+  GetValOrDefault(qr, "in_commod_outs", &in_commod_outs);
+  GetValOrDefault(qr, "processing_throughput", &processing_throughput);
+  GetValOrDefault(qr, "packaging_throughput", &packaging_throughput);
+  GetValOrDefault(qr, "throughput_schedule", &throughput_schedule);
+  GetValOrDefault(qr, "max_inv_size_schedule", &max_inv_size_schedule);
+  GetValOrDefault(qr, "processing_schedule", &processing_schedule);
+  GetValOrDefault(qr, "packaging_schedule", &packaging_schedule);
+  GetValOrDefault(qr, "package_capacity", &package_capacity);
+  GetValOrDefault(qr, "package_fill", &package_fill);
+  GetValOrDefault(qr, "discrete_fill", &discrete_fill);
+  GetValOrDefault(qr, "dense_blend", &dense_blend);
+  GetValOrDefault(qr, "decay_on_ready", &decay_on_ready);
+  GetValOrDefault(qr, "release_order", &release_order);
+  GetValOrDefault(qr, "bulk_receive", &bulk_receive);
+  GetValOrDefault(qr, "consolidate", &consolidate);
+  GetValOrDefault(qr, "cache_requests", &cache_requests);
+  GetValOrDefault(qr, "trace_counters", &trace_counters);
+  GetValOrDefault(qr, "record_stats", &record_stats);
+  GetValOrDefault(qr, "record_inventory", &record_inventory);
+  GetValOrDefault(qr, "inventory_nuclides", &inventory_nuclides);
+  GetValOrDefault(qr, "shadow", &shadow);
+
+  InitCohorts_(b);
+  InitReceived_(b);
+
+  for (int i = 0; i < out_commods.size(); ++i) {
+    cyclus::toolkit::CommodityProducer::Add(
+        cyclus::toolkit::Commodity(out_commods[i]));
+  }
+  SetProducerCapacity_(throughput);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::SetProducerCapacity_(double capacity) {
+  // the lines share one throughput, so each commodity advertises its share
+  // and the total advertised is the facility's capacity
+  for (int i = 0; i < out_commods.size(); ++i) {
+    cyclus::toolkit::CommodityProducer::SetCapacity(
+        cyclus::toolkit::Commodity(out_commods[i]),
+        capacity / out_commods.size());
+  }
+  producer_capacity = capacity;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::Snapshot(cyclus::DbInit di) {
+#pragma cyclus impl snapshot conditioning::Conditioning
+
+  std::vector<CohortRun> runs = CohortRuns_(now());
+  for (int i = 0; i < runs.size(); ++i) {
+    di.NewDatum("Cohorts")
+        ->AddVal("OutCommod", out_commods[runs[i].line])
+        ->AddVal("EntryTime", runs[i].entry_time)
+        ->AddVal("Count", runs[i].count)
+        ->Record();
+  }
+
+  std::vector<ReceivedRun> received = ReceivedRuns_();
+  for (int i = 0; i < received.size(); ++i) {
+    di.NewDatum("ReceivedCommods")
+        ->AddVal("Position", i)
+        ->AddVal("InCommod", received[i].in_commod)
+        ->AddVal("Count", received[i].count)
+        ->Record();
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::vector<Conditioning::ReceivedRun> Conditioning::ReceivedRuns_() {
+  const std::vector<std::string>& commods = buy_policy.received();
+  std::vector<ReceivedRun> runs;
+  for (int i = 0; i < commods.size(); ++i) {
+    if (!runs.empty() && runs.back().in_commod == commods[i]) {
+      ++runs.back().count;
+    } else {
+      ReceivedRun run = {commods[i], 1};
+      runs.push_back(run);
+    }
+  }
+  return runs;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::RestoreReceived_(const std::vector<ReceivedRun>& runs) {
+  std::vector<std::string>& commods = buy_policy.received();
+  commods.clear();
+  for (int i = 0; i < runs.size(); ++i) {
+    commods.insert(commods.end(), runs[i].count, runs[i].in_commod);
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::InitReceived_(cyclus::QueryableBackend* b) {
+  cyclus::QueryResult qr;
+  try {
+    qr = b->Query("ReceivedCommods", NULL);
+  } catch (cyclus::Error& e) {
+    // agents snapshotted with an empty inventory have no table
+  }
+
+  // rows are not guaranteed to come back in the order they were written
+  std::map<int, ReceivedRun> by_position;
+  for (int i = 0; i < qr.rows.size(); ++i) {
+    ReceivedRun run = {qr.GetVal<std::string>("InCommod", i),
+                       qr.GetVal<int>("Count", i)};
+    by_position[qr.GetVal<int>("Position", i)] = run;
+  }
+  std::vector<ReceivedRun> runs;
+  std::map<int, ReceivedRun>::iterator it;
+  for (it = by_position.begin(); it != by_position.end(); ++it) {
+    runs.push_back(it->second);
+  }
+  RestoreReceived_(runs);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::InitCohorts_(cyclus::QueryableBackend* b) {
+  InitLines_();
+
+  std::vector<CohortRun> runs;
+  cyclus::QueryResult qr;
+  try {
+    qr = b->Query("Cohorts", NULL);
+  } catch (cyclus::Error& e) {
+    // prototypes and agents snapshotted without cohorts have no table
+  }
+  for (int i = 0; i < qr.rows.size(); ++i) {
+    std::string commod = qr.GetVal<std::string>("OutCommod", i);
+    CohortRun run;
+    run.line = std::find(out_commods.begin(), out_commods.end(), commod) -
+               out_commods.begin();
+    run.entry_time = qr.GetVal<int>("EntryTime", i);
+    run.count = qr.GetVal<int>("Count", i);
+    if (run.line == out_commods.size()) {
+      throw cyclus::ValueError("unknown Conditioning cohort line " + commod);
+    }
+    runs.push_back(run);
+  }
+  if (runs.empty()) {
+    // earlier versions kept one entry time per package, all on one line
+    std::list<int> entry_times;
+    qr = b->Query("Info", NULL);
+    GetValOrDefault(qr, "entry_times", &entry_times);
+    runs = EntryTimeRuns_(entry_times);
+  }
+  RestoreCohorts_(runs);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::vector<Conditioning::CohortRun> Conditioning::CohortRuns_(int time) const {
+  std::vector<CohortRun> runs;
+  for (int l = 0; l < lines.size(); ++l) {
+    for (int t = std::max(0, time - residence_time); t <= time; ++t) {
+      int count = cohorts[cohort_slot(l, t)];
+      if (count > 0) {
+        CohortRun run = {l, t, count};
+        runs.push_back(run);
+      }
+    }
+  }
+  return runs;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::RestoreCohorts_(const std::vector<CohortRun>& runs) {
+  InitLines_();
+  cohorts.assign(cohorts.size(), 0);
+  for (int i = 0; i < runs.size(); ++i) {
+    cohorts[cohort_slot(runs[i].line, runs[i].entry_time)] += runs[i].count;
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::vector<Conditioning::CohortRun> Conditioning::EntryTimeRuns_(
+    const std::list<int>& entry_times) {
+  std::vector<CohortRun> runs;
+  std::list<int>::const_iterator it;
+  for (it = entry_times.begin(); it != entry_times.end(); ++it) {
+    if (!runs.empty() && runs.back().entry_time == *it) {
+      ++runs.back().count;
+    } else {
+      CohortRun run = {0, *it, 1};
+      runs.push_back(run);
+    }
+  }
+  return runs;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::CohortUncounted_() {
+  int due = std::max(0, now() - residence_time);
+  for (int l = 0; l < lines.size(); ++l) {
+    int counted = 0;
+    for (int t = 0; t <= residence_time; ++t) {
+      counted += cohorts[cohort_slot(l, t)];
+    }
+    if (lines[l].packaged.count() > counted) {
+      cohorts[cohort_slot(l, due)] += lines[l].packaged.count() - counted;
+    }
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+cyclus::Inventories Conditioning::SnapshotInv() {
+  cyclus::Inventories invs;
+  std::vector<cyclus::Material::Ptr> held = Contents_(inventory);
+  invs["inventory"] = cyclus::ResourceVector(held.begin(), held.end());
+
+  const char* stages[] = {"processing", "packaged", "ready", "stocks"};
+  Stage members[] = {&Line::processing, &Line::packaged, &Line::ready,
+                     &Line::stocks};
+  for (int l = 0; l < lines.size(); ++l) {
+    for (int j = 0; j < 4; ++j) {
+      std::vector<cyclus::Material::Ptr> mats = StageContents_(l, members[j]);
+      invs[InvName_(stages[j], l)] =
+          cyclus::ResourceVector(mats.begin(), mats.end());
+    }
+  }
+  return invs;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::InitInv(cyclus::Inventories& inv) {
+  InitLines_();
+
+  std::map<std::string, Stage> members;
+  members["processing"] = &Line::processing;
+  members["packaged"] = &Line::packaged;
+  members["ready"] = &Line::ready;
+  members["stocks"] = &Line::stocks;
+
+  cyclus::Inventories::iterator it;
+  for (it = inv.begin(); it != inv.end(); ++it) {
+    if (it->first == "inventory") {
+      inventory.Push(it->second);
+      continue;
+    }
+
+    // names are "<stage>" for a single line and "<stage>-<out_commod>"
+    // otherwise
+    std::string::size_type dash = it->first.find('-');
+    std::string stage = it->first.substr(0, dash);
+    int l = 0;
+    if (dash != std::string::npos) {
+      std::string commod = it->first.substr(dash + 1);
+      l = std::find(out_commods.begin(), out_commods.end(), commod) -
+          out_commods.begin();
+    }
+    if (members.count(stage) == 0 || l >= lines.size()) {
+      throw cyclus::ValueError("unknown Conditioning inventory " + it->first);
+    }
+    (lines[l].*members[stage]).Push(it->second);
+  }
+  CohortUncounted_();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::map<std::string, size_t> Conditioning::MemoryReport() const {
+  // reading compositions under lazy decay would decay the material
+  std::set<cyclus::Composition*> seen;
+  std::set<cyclus::Composition*>* comps = lazy_decay_() ? NULL : &seen;
+  std::map<std::string, size_t> bytes;
+  bytes["inventory"] = BufBytes_(Contents_(inventory), comps);
 
-  using cyclus::toolkit::Commodity;
-  Commodity commod = Commodity(out_commods.front());
-  cyclus::toolkit::CommodityProducer::Add(commod);
-  cyclus::toolkit::CommodityProducer::SetCapacity(commod, throughput);
+  const char* stages[] = {"processing", "packaged", "ready", "stocks"};
+  Stage members[] = {&Line::processing, &Line::packaged, &Line::ready,
+                     &Line::stocks};
+  size_t bookkeeping = cohorts.capacity() * sizeof(int);
+  for (int l = 0; l < lines.size(); ++l) {
+    for (int j = 0; j < 4; ++j) {
+      bytes[InvName_(stages[j], l)] =
+          BufBytes_(StageContents_(l, members[j]), comps);
+    }
+    // deque and map entries, with a rough allowance for node overhead
+    bookkeeping += lines[l].ready_qtys.size() * sizeof(double) +
+                   lines[l].ranked.size() *
+                       (sizeof(std::pair<double, cyclus::Material::Ptr>) +
+                        4 * sizeof(void*));
+  }
+  bookkeeping += batch_prefs.size() *
+                 (sizeof(std::pair<int, double>) + 4 * sizeof(void*));
+  bytes["bookkeeping"] = bookkeeping;
+  return bytes;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+size_t Conditioning::BufBytes_(const std::vector<cyclus::Material::Ptr>& mats,
+                               std::set<cyclus::Composition*>* seen) {
+  // a material, its shared_ptr control block, and its nodes in the ResBuf
+  // list and membership set
+  const size_t per_mat = sizeof(cyclus::Material) + 3 * sizeof(void*) +
+                         2 * (sizeof(cyclus::Material::Ptr) + 4 * sizeof(void*));
+  // a nuclide entry of a composition's atom and mass maps
+  const size_t per_nuc =
+      2 * (sizeof(std::pair<const int, double>) + 4 * sizeof(void*));
+
+  size_t bytes = mats.size() * per_mat;
+  for (int i = 0; i < mats.size() && seen != NULL; ++i) {
+    cyclus::Composition::Ptr comp = mats[i]->comp();
+    if (seen->insert(comp.get()).second) {
+      bytes += sizeof(cyclus::Composition) + comp->atom().size() * per_nuc;
+    }
+  }
+  return bytes;
 }
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 void Conditioning::EnterNotify() {
   cyclus::Facility::EnterNotify();
+  InitLines_();
+
+  throughput_at.Init(throughput, throughput_schedule);
+  max_inv_size_at.Init(max_inv_size, max_inv_size_schedule);
+  processing_at.Init(processing_throughput, processing_schedule);
+  packaging_at.Init(packaging_throughput, packaging_schedule);
+
   buy_policy.Init(this, &inventory, std::string("inventory"));
 
   // dummy comp, use in_recipe if provided
@@ -70,42 +468,94 @@ void Conditioning::EnterNotify() {
     throw cyclus::ValueError(ss.str());
   }
 
+  if (inventory_nuclides < 0 || inventory_nuclides > kMaxInventoryNuclides) {
+    std::stringstream ss;
+    ss << "inventory_nuclides is " << inventory_nuclides
+       << ", expected 0 to " << kMaxInventoryNuclides;
+    throw cyclus::ValueError(ss.str());
+  }
+
+  if (release_order != "fifo" && release_order != "priority" &&
+      release_order != "largest" && release_order != "smallest") {
+    throw cyclus::ValueError("release_order " + release_order +
+                             " is not one of fifo, priority, largest or "
+                             "smallest");
+  }
+
+  if (out_commods.empty()) {
+    throw cyclus::ValueError("out_commods has no values, expected at least 1.");
+  } else if (in_commod_outs.size() == 0 && out_commods.size() == 1) {
+    in_commod_outs.assign(in_commods.size(), out_commods.front());
+  } else if (in_commod_outs.size() != in_commods.size()) {
+    std::stringstream ss;
+    ss << "in_commod_outs has " << in_commod_outs.size()
+       << " values, expected " << in_commods.size();
+    throw cyclus::ValueError(ss.str());
+  }
+
+  in_commod_lines.clear();
   for (int i = 0; i != in_commods.size(); ++i) {
+    int l = std::find(out_commods.begin(), out_commods.end(),
+                      in_commod_outs[i]) - out_commods.begin();
+    if (l == out_commods.size()) {
+      std::stringstream ss;
+      ss << "in_commod_outs value " << in_commod_outs[i]
+         << " is not one of out_commods";
+      throw cyclus::ValueError(ss.str());
+    }
+    in_commod_lines[in_commods[i]] = l;
     buy_policy.Set(in_commods[i], comp, in_commod_prefs[i]);
   }
+
+  // agents not built from a database prototype have no commodities yet
+  for (int l = 0; l < out_commods.size(); ++l) {
+    cyclus::toolkit::Commodity commod(out_commods[l]);
+    if (!cyclus::toolkit::CommodityProducer::Produces(commod)) {
+      cyclus::toolkit::CommodityProducer::Add(commod);
+    }
+  }
+  SetProducerCapacity_(throughput_at(now()));
+  buy_policy.cache_requests(cache_requests);
+  buy_policy.bulk_receive(bulk_receive ? &inventory : NULL,
+                          !discrete_handling);
   buy_policy.Start();
 
-  if (out_commods.size() == 1) {
-    sell_policy.Init(this, &stocks, std::string("stocks"))
-        .Set(out_commods.front())
+  for (int l = 0; l < lines.size(); ++l) {
+    lines[l].sell_policy.Init(this, &lines[l].stocks, InvName_("stocks", l))
+        .Set(out_commods[l])
         .Start();
-  } else {
-    std::stringstream ss;
-    ss << "out_commods has " << out_commods.size() << " values, expected 1.";
-    throw cyclus::ValueError(ss.str());
   }
   RecordPosition();
 }
 
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::InitLines_() {
+  if (lines.size() != out_commods.size()) {
+    lines.resize(out_commods.size());
+  }
+  if (cohorts.size() != out_commods.size() * (residence_time + 1)) {
+    cohorts.assign(out_commods.size() * (residence_time + 1), 0);
+  }
+}
+
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 std::string Conditioning::str() {
   std::stringstream ss;
   std::string ans, out_str;
-  if (out_commods.size() == 1) {
-    out_str = out_commods.front();
-  } else {
-    out_str = "";
+  for (int i = 0; i < out_commods.size(); ++i) {
+    out_str += (i == 0 ? "" : ", ") + out_commods[i];
   }
-  if (cyclus::toolkit::CommodityProducer::Produces(
-          cyclus::toolkit::Commodity(out_str))) {
-    ans = "yes";
-  } else {
-    ans = "no";
+  ans = "yes";
+  for (int i = 0; i < out_commods.size(); ++i) {
+    if (!cyclus::toolkit::CommodityProducer::Produces(
+            cyclus::toolkit::Commodity(out_commods[i]))) {
+      ans = "no";
+    }
   }
   ss << cyclus::Facility::str();
   ss << " has facility parameters {"
      << "\n"
-     << "     Output Commodity = " << out_str << ",\n"
+     << "     Output Commodities = " << out_str << ",\n"
      << "     Residence Time = " << residence_time << ",\n"
      << "     Throughput = " << throughput << ",\n"
      << " commod producer members: "
@@ -115,47 +565,116 @@ std::string Conditioning::str() {
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 void Conditioning::Tick() {
-  // Set available capacity for Buy Policy
-  inventory.capacity(current_capacity());
+  Clock::time_point start = Clock::now();
 
-  LOG(cyclus::LEV_INFO3, "ComCnv") << prototype() << " is ticking {";
+  // Set available capacity for Buy Policy. A schedule may lower the limit
+  // below what is already held, which then stays held, with no room for more
+  double cap = current_capacity();
+  inventory.capacity(std::max(cap, inventory.quantity()));
 
-  if (current_capacity() > cyclus::eps_rsrc()) {
-    LOG(cyclus::LEV_INFO4, "ComCnv")
-        << " has capacity for " << current_capacity() << " kg of material.";
+  double scheduled = throughput_at(now());
+  if (scheduled != producer_capacity) {
+    SetProducerCapacity_(scheduled);
+  }
+
+  CYDER_LOG(cyclus::LEV_INFO3, "ComCnv") << prototype() << " is ticking {";
+  CYDER_TRACE(CYDER_TRACE_PHASE, this, "tick", inventory.count());
+
+  if (cap > cyclus::eps_rsrc()) {
+    CYDER_LOG(cyclus::LEV_INFO4, "ComCnv")
+        << " has capacity for " << cap << " kg of material.";
+  }
+  CYDER_LOG(cyclus::LEV_INFO3, "ComCnv") << "}";
+
+  tick_time = SecondsSince(start);
+  if (!defer_output_) {
+    FlushOutput();
   }
-  LOG(cyclus::LEV_INFO3, "ComCnv") << "}";
 }
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 void Conditioning::Tock() {
-  LOG(cyclus::LEV_INFO3, "ComCnv") << prototype() << " is tocking {";
+  Clock::time_point start = Clock::now();
+  CYDER_LOG(cyclus::LEV_INFO3, "ComCnv") << prototype() << " is tocking {";
+  CYDER_TRACE(CYDER_TRACE_PHASE, this, "tock", inventory.count());
+
+  to_processing = Transfer();
+  to_packaged = Transfer();
+  to_ready = Transfer();
+  to_stocks = Transfer();
+
+  ShadowModel model;
+  // under lazy decay the shadow sees no compositions, so it cannot tell
+  // which batches consolidate would merge
+  bool shadowed = (shadow || kShadowBuild) && !(consolidate && lazy_decay_());
+  if (shadowed) {
+    SeedShadow_(model);
+  }
+
+  if (idle()) {
+    // nothing was received, nothing is ready and no cohort is due
+    process_time = 0;
+  } else {
+    BeginProcessing_();  // place unprocessed inventory into processing
+    double pack_cap = packaging_at(now());
+    for (int k = 0; k < lines.size(); ++k) {
+      int l = (first_line_() + k) % lines.size();
+      pack_cap -= PackageMatl_(l, pack_cap);
+      if (ready_time() >= 0) {
+        ReadyMatl_(l, ready_time());  // place processing into ready
+      }
+    }
+
+    Clock::time_point process_start = Clock::now();
+    ProcessMat_(throughput_at(now()));  // place ready into stocks
+    process_time = SecondsSince(process_start);
+    next_due = NextDue_();
+  }
 
-  BeginProcessing_();  // place unprocessed inventory into processing
-  PackageMatl_();
+  if (shadowed) {
+    model.Tock(ShadowParams_(), now());
+    CheckShadow_(model);
+  }
+
+#ifdef CYDER_DEBUG
+  CheckTotals_();
+#endif
 
-  if (ready_time() >= 0 || residence_time == 0 && !inventory.empty()) {
-    ReadyMatl_(ready_time());  // place processing into ready
+  if (trace_counters) {
+    RecordTrace_();
+  }
+  if (record_stats) {
+    RecordStats_(SecondsSince(start));
+  }
+  if (record_inventory) {
+    RecordInventory_();
   }
 
-  ProcessMat_(throughput);  // place ready into stocks
+  CYDER_LOG(cyclus::LEV_INFO3, "ComCnv") << "}";
+  if (!defer_output_) {
+    FlushOutput();
+  }
+}
 
-  LOG(cyclus::LEV_INFO3, "ComCnv") << "}";
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::FlushOutput() {
+  output_.Flush(context());
 }
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 void Conditioning::AddMat_(cyclus::Material::Ptr mat) {
-  LOG(cyclus::LEV_INFO5, "ComCnv") << prototype() << " is initially holding "
+  CYDER_LOG(cyclus::LEV_INFO5, "ComCnv") << prototype() << " is initially holding "
                                    << inventory.quantity() << " total.";
 
   try {
     inventory.Push(mat);
+    buy_policy.received().push_back("");
   } catch (cyclus::Error& e) {
     e.msg(Agent::InformErrorMsg(e.msg()));
     throw e;
   }
 
-  LOG(cyclus::LEV_INFO5, "ComCnv")
+  CYDER_LOG(cyclus::LEV_INFO5, "ComCnv")
       << prototype() << " added " << mat->quantity()
       << " of material to its inventory, which is holding "
       << inventory.quantity() << " total.";
@@ -163,91 +682,823 @@ void Conditioning::AddMat_(cyclus::Material::Ptr mat) {
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 void Conditioning::BeginProcessing_() {
-  while (inventory.count() > 0) {
-    try {
-      processing.Push(inventory.Pop());
-      entry_times.push_back(context()->time());
-      std::cout << "processed" << std::endl;
+  using cyclus::Material;
 
-      LOG(cyclus::LEV_DEBUG2, "ComCnv")
-          << "Conditioning " << prototype()
-          << " added resources to processing at t= " << context()->time();
-    } catch (cyclus::Error& e) {
-      e.msg(Agent::InformErrorMsg(e.msg()));
-      throw e;
+  if (inventory.empty()) {
+    return;
+  }
+
+  try {
+    int held = inventory.count();
+    double qty = inventory.quantity();
+    std::vector<Material::Ptr> mats = PopUpTo_(
+        inventory, processing_at(now()), !discrete_handling);
+    int n = mats.size();
+    to_processing.qty += qty - inventory.quantity();
+
+    // materials were pushed in the order their commodities were received,
+    // a split material keeps its place and commodity at the front
+    std::vector<std::string>& commods = buy_policy.received();
+    std::vector<std::vector<Material::Ptr> > routed(lines.size());
+    for (int i = 0; i < mats.size(); ++i) {
+      std::string commod = i < commods.size() ? commods[i] : "";
+      routed[LineOf_(commod)].push_back(mats[i]);
+      if (discrete_handling && release_order == "priority") {
+        batch_prefs[mats[i]->obj_id()] = PrefOf_(commod);
+      }
     }
+    int consumed = std::min<int>(held - inventory.count(), commods.size());
+    commods.erase(commods.begin(), commods.begin() + consumed);
+
+    for (int l = 0; l < lines.size(); ++l) {
+      if (consolidate && routed[l].size() > 1) {
+        routed[l] = Consolidate_(routed[l]);
+      }
+      if (!routed[l].empty()) {
+        lines[l].processing.Push(routed[l]);
+      }
+    }
+    to_processing.count += n;
+    CYDER_TRACE(CYDER_TRACE_STAGE, this, "processed", n);
+
+    CYDER_LOG(cyclus::LEV_DEBUG2, "ComCnv")
+        << "Conditioning " << prototype() << " added " << n
+        << " resources to processing at t= " << now();
+  } catch (cyclus::Error& e) {
+    e.msg(Agent::InformErrorMsg(e.msg()));
+    throw e;
   }
 }
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-void Conditioning::PackageMatl_() {
-   while (processing.count() > 0) {
-    try {
-      packaged.Push(processing.Pop());
-      std::cout << "packaged" << std::endl;
+double Conditioning::PackageMatl_(int l, double cap) {
+  Line& line = lines[l];
+  if (line.processing.empty() || cap <= cyclus::eps_rsrc()) {
+    return 0;
+  }
 
-      LOG(cyclus::LEV_DEBUG2, "ComCnv")
-          << "Conditioning " << prototype()
-          << " added resources to packaged at t= " << context()->time();
-    } catch (cyclus::Error& e) {
-      e.msg(Agent::InformErrorMsg(e.msg()));
-      throw e;
+  try {
+    double qty = line.processing.quantity();
+    std::vector<cyclus::Material::Ptr> mats =
+        PopUpTo_(line.processing, cap, !discrete_handling);
+    double packed = qty - line.processing.quantity();
+    std::vector<cyclus::Material::Ptr> pkgs = Package_(mats);
+    line.packaged.Push(pkgs);
+
+    cohorts[cohort_slot(l, now())] += pkgs.size();
+    to_packaged.qty += packed;
+    to_packaged.count += pkgs.size();
+    CYDER_TRACE(CYDER_TRACE_STAGE, this, "packaged", pkgs.size());
+
+    CYDER_LOG(cyclus::LEV_DEBUG2, "ComCnv")
+        << "Conditioning " << prototype() << " packed " << mats.size()
+        << " resources into " << pkgs.size() << " packages at t= "
+        << now();
+    return packed;
+  } catch (cyclus::Error& e) {
+    e.msg(Agent::InformErrorMsg(e.msg()));
+    throw e;
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::vector<cyclus::Material::Ptr> Conditioning::PopUpTo_(
+    cyclus::toolkit::ResBuf<cyclus::Material>& buf, double cap, bool split) {
+  if (buf.quantity() <= cap + cyclus::eps_rsrc()) {
+    return buf.PopN(buf.count());
+  }
+
+  std::vector<cyclus::Material::Ptr> mats;
+  double remaining = cap;
+  while (!buf.empty() &&
+         buf.Peek()->quantity() <= remaining + cyclus::eps_rsrc()) {
+    remaining -= buf.Peek()->quantity();
+    mats.push_back(buf.Pop());
+  }
+  if (split && remaining > cyclus::eps_rsrc() && !buf.empty()) {
+    // splits the front material only
+    mats.push_back(buf.Pop(remaining, cyclus::eps_rsrc()));
+  }
+  return mats;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::vector<cyclus::Material::Ptr> Conditioning::Consolidate_(
+    const std::vector<cyclus::Material::Ptr>& mats) {
+  std::vector<cyclus::Material::Ptr> merged;
+  std::map<int, int> by_comp;  // index in merged of each composition id
+  for (int i = 0; i < mats.size(); ++i) {
+    int id = mats[i]->comp()->id();
+    std::map<int, int>::iterator it = by_comp.find(id);
+    if (it == by_comp.end()) {
+      by_comp[id] = merged.size();
+      merged.push_back(mats[i]);
+    } else {
+      cyclus::Material::Ptr into = merged[it->second];
+      InheritPref_(into->obj_id(), mats[i]->obj_id());
+      batch_prefs.erase(mats[i]->obj_id());
+      into->Absorb(mats[i]);
     }
   }
+  return merged;
 }
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-void Conditioning::ReadyMatl_(int time) {
-  using cyclus::toolkit::ResBuf;
+std::vector<cyclus::Material::Ptr> Conditioning::Package_(
+    const std::vector<cyclus::Material::Ptr>& mats) {
+  using cyclus::Material;
 
-  int to_ready = 0;
+  if (package_capacity <= 0 || mats.empty()) {
+    return mats;
+  }
 
-  while (!entry_times.empty() && entry_times.front() <= time) {
-    entry_times.pop_front();
-    ++to_ready;
+  std::vector<Material::Ptr> pkgs;
+  if (package_fill) {
+    Material::Ptr mixed = mats.front();
+    for (int i = 1; i < mats.size(); ++i) {
+      InheritPref_(mixed->obj_id(), mats[i]->obj_id());
+      batch_prefs.erase(mats[i]->obj_id());
+      mixed->Absorb(mats[i]);
+    }
+    while (mixed->quantity() > package_capacity + cyclus::eps_rsrc()) {
+      pkgs.push_back(mixed->ExtractQty(package_capacity));
+      InheritPref_(pkgs.back()->obj_id(), mixed->obj_id());
+    }
+    pkgs.push_back(mixed);
+  } else {
+    Material::Ptr pkg = mats.front();
+    for (int i = 1; i < mats.size(); ++i) {
+      if (pkg->quantity() + mats[i]->quantity() <=
+          package_capacity + cyclus::eps_rsrc()) {
+        InheritPref_(pkg->obj_id(), mats[i]->obj_id());
+        batch_prefs.erase(mats[i]->obj_id());
+        pkg->Absorb(mats[i]);
+      } else {
+        pkgs.push_back(pkg);
+        pkg = mats[i];
+      }
+    }
+    pkgs.push_back(pkg);
+  }
+  return pkgs;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::ReadyMatl_(int l, int time) {
+  Line& line = lines[l];
+  int slot = cohort_slot(l, time);
+  int n = cohorts[slot];
+  cohorts[slot] = 0;
+
+  if (n > 0) {
+    double qty = line.ready_qty();
+    std::vector<cyclus::Material::Ptr> mats = line.packaged.PopN(n);
+    if (decay_on_ready && context()->sim_info().decay != "lazy") {
+      DecayCohort_(mats);
+    }
+    if (ranked_release()) {
+      for (int i = 0; i < mats.size(); ++i) {
+        line.ranked.insert(std::make_pair(Rank_(mats[i]), mats[i]));
+        line.ranked_qty += mats[i]->quantity();
+        batch_prefs.erase(mats[i]->obj_id());
+      }
+    } else {
+      if (discrete_handling) {
+        for (int i = 0; i < mats.size(); ++i) {
+          line.ready_qtys.push_back(mats[i]->quantity());
+        }
+      }
+      line.ready.Push(mats);
+    }
+    to_ready.count += n;
+    to_ready.qty += line.ready_qty() - qty;
+    CYDER_TRACE(CYDER_TRACE_STAGE, this, "readied", n);
   }
+}
 
-  ready.Push(packaged.PopN(to_ready));
-  std::cout << "readyed" << std::endl;
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::DecayCohort_(
+    const std::vector<cyclus::Material::Ptr>& mats) {
+  try {
+    for (int i = 0; i < mats.size(); ++i) {
+      mats[i]->Decay(now());
+    }
+  } catch (cyclus::Error& e) {
+    e.msg(Agent::InformErrorMsg(e.msg()));
+    throw e;
+  }
 }
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 void Conditioning::ProcessMat_(double cap) {
-  using cyclus::Material;
-  using cyclus::ResCast;
-  using cyclus::toolkit::ResBuf;
-  using cyclus::toolkit::Manifest;
+  for (int k = 0; k < lines.size() && cap > cyclus::eps_rsrc(); ++k) {
+    Line& line = lines[(first_line_() + k) % lines.size()];
+    if (line.ready_count() == 0) {
+      continue;
+    }
 
-  if (!ready.empty()) {
+    int n_before = line.stocks.count();
+    double qty_before = line.stocks.quantity();
     try {
-      double max_pop = std::min(cap, ready.quantity());
+      double ready_qty = line.ready_qty();
+      double max_pop = std::min(cap, ready_qty);
 
-      if (discrete_handling) {
-        if (max_pop == ready.quantity()) {
-          stocks.Push(ready.PopN(ready.count()));
+      if (ranked_release()) {
+        RankReady_(line);
+        ReleaseRanked_(line, max_pop);
+      } else if (discrete_handling) {
+        SyncReadyQtys_(line);
+        if (max_pop == ready_qty) {
+          line.stocks.Push(line.ready.PopN(line.ready.count()));
+          line.ready_qtys.clear();
         } else {
-          double cap_pop = ready.Peek()->quantity();
-          while (cap_pop <= max_pop && !ready.empty()) {
-            stocks.Push(ready.Pop());
-            cap_pop += ready.empty() ? 0 : ready.Peek()->quantity();
-          }
+          ReleaseDiscrete_(line, max_pop);
         }
       } else {
-        stocks.Push(ready.Pop(max_pop, cyclus::eps_rsrc()));
-        std::cout << "processedmat" << std::endl;
+        if (dense_blend) {
+          line.stocks.Push(PopBlend_(line.ready, max_pop));
+        } else {
+          line.stocks.Push(line.ready.Pop(max_pop, cyclus::eps_rsrc()));
+        }
       }
 
-      LOG(cyclus::LEV_INFO1, "ComCnv") << "Conditioning " << prototype()
+      CYDER_LOG(cyclus::LEV_INFO1, "ComCnv") << "Conditioning " << prototype()
                                        << " moved resources"
                                        << " from ready to stocks"
-                                       << " at t= " << context()->time();
+                                       << " at t= " << now();
     } catch (cyclus::Error& e) {
       e.msg(Agent::InformErrorMsg(e.msg()));
       throw e;
     }
+    double moved = line.stocks.quantity() - qty_before;
+    cap -= moved;
+    to_stocks.count += line.stocks.count() - n_before;
+    to_stocks.qty += moved;
+    CYDER_TRACE(CYDER_TRACE_STAGE, this, "stocked",
+                line.stocks.count() - n_before);
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::ReleaseDiscrete_(Line& line, double max_pop) {
+  // count the leading batches that fit, summing in the same order as the
+  // batches would be popped so the cut-off matches a pop-by-pop release
+  std::deque<double>& qtys = line.ready_qtys;
+  int n = 0;
+  double cap_pop = qtys.front();
+  while (cap_pop <= max_pop && n < qtys.size()) {
+    ++n;
+    cap_pop += n < qtys.size() ? qtys[n] : 0;
+  }
+
+  if (n > 0) {
+    line.stocks.Push(line.ready.PopN(n));
+    qtys.erase(qtys.begin(), qtys.begin() + n);
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::ReleaseRanked_(Line& line, double max_pop) {
+  using cyclus::Material;
+  typedef std::multimap<double, Material::Ptr>::iterator Iter;
+
+  std::vector<Material::Ptr> release;
+  double remaining = max_pop;
+  if (max_pop == line.ranked_qty) {
+    for (Iter it = line.ranked.begin(); it != line.ranked.end(); ++it) {
+      release.push_back(it->second);
+    }
+    line.ranked.clear();
+  } else if (release_order == "largest") {
+    // ranks are negated quantities, so the first rank not below -remaining
+    // is the largest batch that fits
+    Iter it = line.ranked.lower_bound(-remaining);
+    while (it != line.ranked.end()) {
+      remaining -= it->second->quantity();
+      release.push_back(it->second);
+      line.ranked.erase(it);
+      it = line.ranked.lower_bound(-remaining);
+    }
+  } else {
+    // fill walks past the batches that do not fit, except by size, as once
+    // the smallest batch left does not fit none does
+    bool skip = discrete_fill && release_order != "smallest";
+    Iter it = line.ranked.begin();
+    while (it != line.ranked.end()) {
+      double qty = it->second->quantity();
+      if (qty <= remaining) {
+        remaining -= qty;
+        release.push_back(it->second);
+        line.ranked.erase(it++);
+      } else if (skip) {
+        ++it;
+      } else {
+        break;
+      }
+    }
+  }
+
+  for (int i = 0; i < release.size(); ++i) {
+    line.ranked_qty -= release[i]->quantity();
+  }
+  if (line.ranked.empty()) {
+    line.ranked_qty = 0;  // no rounding residue
+  }
+  line.stocks.Push(release);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::SyncReadyQtys_(Line& line) {
+  if (line.ready_qtys.size() == line.ready.count()) {
+    return;
+  }
+
+  std::vector<cyclus::Material::Ptr> mats = line.ready.PopN(line.ready.count());
+  line.ready_qtys.clear();
+  for (int i = 0; i < mats.size(); ++i) {
+    line.ready_qtys.push_back(mats[i]->quantity());
+  }
+  line.ready.Push(mats);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::RankReady_(Line& line) {
+  if (line.ready.empty()) {
+    return;
+  }
+
+  std::vector<cyclus::Material::Ptr> mats = line.ready.PopN(line.ready.count());
+  for (int i = 0; i < mats.size(); ++i) {
+    line.ranked.insert(std::make_pair(Rank_(mats[i]), mats[i]));
+    line.ranked_qty += mats[i]->quantity();
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double Conditioning::Rank_(cyclus::Material::Ptr mat) const {
+  if (release_order == "fifo") {
+    return 0;
+  } else if (release_order == "largest") {
+    return -mat->quantity();
+  } else if (release_order == "smallest") {
+    return mat->quantity();
+  }
+  std::map<int, double>::const_iterator it = batch_prefs.find(mat->obj_id());
+  return -(it == batch_prefs.end() ? cyclus::kDefaultPref : it->second);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double Conditioning::PrefOf_(const std::string& in_commod) const {
+  int i = std::find(in_commods.begin(), in_commods.end(), in_commod) -
+          in_commods.begin();
+  return i < in_commod_prefs.size() ? in_commod_prefs[i]
+                                    : cyclus::kDefaultPref;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::InheritPref_(int to, int from) {
+  if (release_order != "priority") {
+    return;
+  }
+  std::map<int, double>::iterator it = batch_prefs.find(from);
+  if (it == batch_prefs.end()) {
+    return;
+  }
+  double pref = it->second;
+  it = batch_prefs.find(to);
+  if (it == batch_prefs.end() || it->second < pref) {
+    batch_prefs[to] = pref;
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+cyclus::Material::Ptr Conditioning::PopBlend_(
+    cyclus::toolkit::ResBuf<cyclus::Material>& buf, double qty) {
+  return Blend_(PopUpTo_(buf, qty, true));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+cyclus::Material::Ptr Conditioning::Blend_(
+    const std::vector<cyclus::Material::Ptr>& mats) {
+  using cyclus::Composition;
+  using cyclus::Material;
+
+  // group batches by composition, the absorbs within a group need no merge
+  std::vector<Material::Ptr> heads;
+  std::map<Composition::Ptr, int> group;
+  for (int i = 0; i < mats.size(); ++i) {
+    std::map<Composition::Ptr, int>::iterator it = group.find(mats[i]->comp());
+    if (it == group.end()) {
+      group[mats[i]->comp()] = heads.size();
+      heads.push_back(mats[i]);
+    } else {
+      heads[it->second]->Absorb(mats[i]);
+    }
   }
+
+  // one merge per further distinct composition
+  for (int g = 1; g < heads.size(); ++g) {
+    heads.front()->Absorb(heads[g]);
+  }
+  return heads.front();
 }
 
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+int Conditioning::NextDue_() const {
+  // cohorts that entered at or before now - residence_time have already been
+  // moved to ready
+  int time = now();
+  int due = INT_MAX;
+  for (int l = 0; l < lines.size(); ++l) {
+    for (int t = time - residence_time + 1;
+         t <= time && t + residence_time < due; ++t) {
+      if (t >= 0 && cohorts[cohort_slot(l, t)] > 0) {
+        due = t + residence_time;
+        break;
+      }
+    }
+  }
+  return due;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double Conditioning::StageQty_(Stage stage) const {
+  double qty = 0;
+  for (int l = 0; l < lines.size(); ++l) {
+    qty += stage == &Line::ready ? lines[l].ready_qty()
+                                 : (lines[l].*stage).quantity();
+  }
+  return qty;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+int Conditioning::StageCount_(Stage stage) const {
+  int n = 0;
+  for (int l = 0; l < lines.size(); ++l) {
+    n += stage == &Line::ready ? lines[l].ready_count()
+                               : (lines[l].*stage).count();
+  }
+  return n;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+int Conditioning::LineOf_(const std::string& in_commod) const {
+  std::map<std::string, int>::const_iterator it =
+      in_commod_lines.find(in_commod);
+  return it == in_commod_lines.end() ? 0 : it->second;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::string Conditioning::InvName_(const std::string& stage, int l) const {
+  return out_commods.size() == 1 ? stage : stage + "-" + out_commods[l];
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::CheckTotals_() {
+  std::stringstream ss;
+
+  for (int l = 0; l < lines.size(); ++l) {
+    Line& line = lines[l];
+    int in_residence = 0;
+    for (int t = 0; t <= residence_time; ++t) {
+      in_residence += cohorts[cohort_slot(l, t)];
+    }
+    if (in_residence != line.packaged.count()) {
+      ss << "line " << out_commods[l] << " cohorts hold " << in_residence
+         << " packages but packaged holds " << line.packaged.count()
+         << ". ";
+    }
+
+    if (ranked_release()) {
+      double qty = 0;
+      std::multimap<double, cyclus::Material::Ptr>::iterator it;
+      for (it = line.ranked.begin(); it != line.ranked.end(); ++it) {
+        qty += it->second->quantity();
+      }
+      if (!TotalsAgree(qty, line.ranked_qty)) {
+        ss << "line " << out_commods[l] << " ranked holds " << qty
+           << " kg but ranked_qty is " << line.ranked_qty << " kg. ";
+      }
+    } else if (discrete_handling) {
+      double qty = 0;
+      for (int i = 0; i < line.ready_qtys.size(); ++i) {
+        qty += line.ready_qtys[i];
+      }
+      if (line.ready_qtys.size() != line.ready.count() ||
+          !TotalsAgree(qty, line.ready.quantity())) {
+        ss << "line " << out_commods[l] << " ready_qtys holds "
+           << line.ready_qtys.size() << " batches (" << qty
+           << " kg) but ready holds " << line.ready.count() << " ("
+           << line.ready.quantity() << " kg). ";
+      }
+    }
+  }
+
+  if (!ss.str().empty()) {
+    throw cyclus::StateError(Agent::InformErrorMsg(ss.str()));
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::RecordTrace_() {
+  output_.NewDatum("ConditioningTrace")
+      ->AddVal("AgentId", id())
+      ->AddVal("Time", now())
+      ->AddVal("Processed", to_processing.count)
+      ->AddVal("Packaged", to_packaged.count)
+      ->AddVal("Readied", to_ready.count)
+      ->AddVal("Stocked", to_stocks.count)
+      ->Record();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::RecordStats_(double tock_time) {
+  double sell_time = 0;
+  for (int l = 0; l < lines.size(); ++l) {
+    sell_time += lines[l].sell_policy.Lap();
+  }
+
+  output_.NewDatum("ConditioningStats")
+      ->AddVal("AgentId", id())
+      ->AddVal("Time", now())
+      ->AddVal("InventoryQty", inventory.quantity())
+      ->AddVal("InventoryCount", inventory.count())
+      ->AddVal("ProcessingQty", StageQty_(&Line::processing))
+      ->AddVal("ProcessingCount", StageCount_(&Line::processing))
+      ->AddVal("PackagedQty", StageQty_(&Line::packaged))
+      ->AddVal("PackagedCount", StageCount_(&Line::packaged))
+      ->AddVal("ReadyQty", StageQty_(&Line::ready))
+      ->AddVal("ReadyCount", StageCount_(&Line::ready))
+      ->AddVal("StocksQty", StageQty_(&Line::stocks))
+      ->AddVal("StocksCount", StageCount_(&Line::stocks))
+      ->AddVal("ToProcessingQty", to_processing.qty)
+      ->AddVal("ToPackagedQty", to_packaged.qty)
+      ->AddVal("ToReadyQty", to_ready.qty)
+      ->AddVal("ToStocksQty", to_stocks.qty)
+      ->AddVal("TickTime", tick_time)
+      ->AddVal("TockTime", tock_time)
+      ->AddVal("ProcessMatTime", process_time)
+      ->AddVal("BuyPolicyTime", buy_policy.Lap())
+      ->AddVal("SellPolicyTime", sell_time)
+      ->Record();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::RecordInventory_() {
+  output_.NewDatum("ConditioningInventory")
+      ->AddVal("AgentId", id())
+      ->AddVal("Time", now())
+      ->AddVal("InventoryQty", inventory.quantity())
+      ->AddVal("ProcessingQty", StageQty_(&Line::processing))
+      ->AddVal("PackagedQty", StageQty_(&Line::packaged))
+      ->AddVal("ReadyQty", StageQty_(&Line::ready))
+      ->AddVal("StocksQty", StageQty_(&Line::stocks))
+      ->Record();
+
+  // reading compositions under lazy decay would decay the material
+  if (inventory_nuclides == 0 || lazy_decay_()) {
+    return;
+  }
+
+  cyclus::CompMap totals;
+  AddNuclides_(Contents_(inventory), totals);
+  for (int l = 0; l < lines.size(); ++l) {
+    AddNuclides_(StageContents_(l, &Line::processing), totals);
+    AddNuclides_(StageContents_(l, &Line::packaged), totals);
+    AddNuclides_(StageContents_(l, &Line::ready), totals);
+    AddNuclides_(StageContents_(l, &Line::stocks), totals);
+  }
+
+  // one row per nuclide, heaviest first, so agents recording different
+  // numbers of nuclides share the table's columns
+  std::vector<std::pair<double, int> > by_mass;
+  cyclus::CompMap::iterator it;
+  for (it = totals.begin(); it != totals.end(); ++it) {
+    by_mass.push_back(std::make_pair(it->second, it->first));
+  }
+  int k = std::min<int>(inventory_nuclides, by_mass.size());
+  std::partial_sort(by_mass.begin(), by_mass.begin() + k, by_mass.end(),
+                    std::greater<std::pair<double, int> >());
+  for (int i = 0; i < k; ++i) {
+    output_.NewDatum("ConditioningNuclides")
+        ->AddVal("AgentId", id())
+        ->AddVal("Time", now())
+        ->AddVal("Rank", i + 1)
+        ->AddVal("Nuc", by_mass[i].second)
+        ->AddVal("Qty", by_mass[i].first)
+        ->Record();
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::AddNuclides_(
+    const std::vector<cyclus::Material::Ptr>& mats, cyclus::CompMap& totals) {
+  for (int i = 0; i < mats.size(); ++i) {
+    cyclus::CompMap c = mats[i]->comp()->mass();
+    cyclus::compmath::Normalize(&c, mats[i]->quantity());
+    cyclus::CompMap::iterator it;
+    for (it = c.begin(); it != c.end(); ++it) {
+      totals[it->first] += it->second;
+    }
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::vector<cyclus::Material::Ptr> Conditioning::Contents_(
+    const cyclus::toolkit::ResBuf<cyclus::Material>& buf) {
+  cyclus::toolkit::ResBuf<cyclus::Material> view(buf);
+  return view.PopN(view.count());
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::vector<cyclus::Material::Ptr> Conditioning::StageContents_(
+    int l, Stage stage) const {
+  const Line& line = lines[l];
+  if (stage != &Line::ready || line.ranked.empty()) {
+    return Contents_(line.*stage);
+  }
+
+  std::vector<cyclus::Material::Ptr> mats;
+  std::multimap<double, cyclus::Material::Ptr>::const_iterator it;
+  for (it = line.ranked.begin(); it != line.ranked.end(); ++it) {
+    mats.push_back(it->second);
+  }
+  std::vector<cyclus::Material::Ptr> unranked = Contents_(line.ready);
+  mats.insert(mats.end(), unranked.begin(), unranked.end());
+  return mats;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+int Conditioning::first_line_() const {
+  return lines.empty() ? 0 : now() % lines.size();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+bool Conditioning::lazy_decay_() const {
+  return context()->sim_info().decay == "lazy";
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Conditioning::SeedShadow_(ShadowModel& model) {
+  using cyclus::Material;
+
+  bool priority = discrete_handling && release_order == "priority";
+  bool lazy = lazy_decay_();
+  const std::vector<std::string>& commods = buy_policy.received();
+  std::vector<Material::Ptr> mats = Contents_(inventory);
+  model.inventory.clear();
+  for (int i = 0; i < mats.size(); ++i) {
+    std::string commod = i < commods.size() ? commods[i] : "";
+    ShadowBatch b = {mats[i]->quantity(), CompId(mats[i], lazy),
+                     LineOf_(commod), priority ? -PrefOf_(commod) : 0, 0};
+    model.inventory.push_back(b);
+  }
+
+  std::vector<CohortRun> runs = CohortRuns_(now());
+  int run = 0;
+  model.lines.assign(lines.size(), ShadowModel::Line());
+  for (int l = 0; l < lines.size(); ++l) {
+    Line& line = lines[l];
+    ShadowModel::Line& shadow_line = model.lines[l];
+
+    mats = Contents_(line.processing);
+    for (int i = 0; i < mats.size(); ++i) {
+      ShadowBatch b = {mats[i]->quantity(), CompId(mats[i], lazy), l,
+                       priority ? Rank_(mats[i]) : 0, 0};
+      shadow_line.processing.push_back(b);
+    }
+
+    // packages are held in the order of the cohorts they entered with, and
+    // runs list each line's cohorts oldest first
+    mats = Contents_(line.packaged);
+    int left = 0;
+    for (int i = 0; i < mats.size(); ++i) {
+      while (left == 0 && run < runs.size()) {
+        left = runs[run].line == l ? runs[run].count : 0;
+        ++run;
+      }
+      --left;
+      int entry = run > 0 ? runs[run - 1].entry_time : now();
+      ShadowBatch b = {mats[i]->quantity(), CompId(mats[i], lazy), l,
+                       priority ? Rank_(mats[i]) : 0, entry};
+      shadow_line.packaged.push_back(b);
+    }
+
+    // ranked batches first, in rank order, as those not yet ranked are
+    // ranked after them
+    std::multimap<double, Material::Ptr>::iterator it;
+    for (it = line.ranked.begin(); it != line.ranked.end(); ++it) {
+      Material::Ptr mat = it->second;
+      ShadowBatch b = {mat->quantity(), CompId(mat, lazy), l, it->first, 0};
+      shadow_line.ready.push_back(b);
+    }
+    mats = Contents_(line.ready);
+    for (int i = 0; i < mats.size(); ++i) {
+      ShadowBatch b = {mats[i]->quantity(), CompId(mats[i], lazy), l,
+                       ranked_release() ? Rank_(mats[i]) : 0, 0};
+      shadow_line.ready.push_back(b);
+    }
+
+    mats = Contents_(line.stocks);
+    for (int i = 0; i < mats.size(); ++i) {
+      ShadowBatch b = {mats[i]->quantity(), CompId(mats[i], lazy), l, 0, 0};
+      shadow_line.stocks.push_back(b);
+    }
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ShadowModel::Params Conditioning::ShadowParams_() const {
+  ShadowModel::Params p;
+  p.residence_time = residence_time;
+  p.discrete = discrete_handling;
+  p.fill = discrete_fill;
+  p.release_order = release_order;
+  p.package_capacity = package_capacity;
+  p.package_fill = package_fill;
+  p.consolidate = consolidate;
+  p.processing = processing_at(now());
+  p.packaging = packaging_at(now());
+  p.throughput = throughput_at(now());
+  return p;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+bool Conditioning::CheckShadow_(const ShadowModel& model) {
+  const char* stages[] = {"processing", "packaged", "ready", "stocks"};
+  Stage members[] = {&Line::processing, &Line::packaged, &Line::ready,
+                     &Line::stocks};
+  ShadowModel::Stage ShadowModel::Line::*shadow_members[] = {
+      &ShadowModel::Line::processing, &ShadowModel::Line::packaged,
+      &ShadowModel::Line::ready, &ShadowModel::Line::stocks};
+
+  std::string name = "inventory";
+  double expected = 0;
+  double actual = 0;
+  std::string diff = CompareShadow_(Contents_(inventory), model.inventory,
+                                    &expected, &actual);
+  for (int l = 0; l < lines.size() && diff.empty(); ++l) {
+    for (int j = 0; j < 4 && diff.empty(); ++j) {
+      name = InvName_(stages[j], l);
+      const ShadowModel::Stage& want = model.lines[l].*shadow_members[j];
+      // ranked lines list their ready batches in rank order
+      bool by_rank = members[j] == &Line::ready && ranked_release();
+      diff = CompareShadow_(StageContents_(l, members[j]),
+                            by_rank ? ShadowModel::ByRank(want) : want,
+                            &expected, &actual);
+    }
+  }
+  if (diff.empty()) {
+    return true;
+  }
+
+  if (!shadow_diverged) {
+    shadow_diverged = true;
+    output_.NewDatum("ConditioningShadow")
+        ->AddVal("AgentId", id())
+        ->AddVal("Time", now())
+        ->AddVal("Buffer", name)
+        ->AddVal("Field", diff)
+        ->AddVal("Expected", expected)
+        ->AddVal("Actual", actual)
+        ->Record();
+    CYDER_LOG(cyclus::LEV_ERROR, "ComCnv")
+        << "Conditioning " << prototype() << " diverged from its shadow model"
+        << " at t= " << now() << ": " << name << " " << diff << " is "
+        << actual << ", expected " << expected;
+  }
+  return false;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::string Conditioning::CompareShadow_(
+    const std::vector<cyclus::Material::Ptr>& mats,
+    const ShadowModel::Stage& want, double* expected, double* actual) {
+  double tol = cyclus::eps_rsrc();
+  double qty = 0;
+  for (int i = 0; i < mats.size(); ++i) {
+    qty += mats[i]->quantity();
+  }
+  if (mats.size() != want.size()) {
+    *expected = want.size();
+    *actual = mats.size();
+    return "count";
+  } else if (std::abs(qty - ShadowModel::Qty(want)) >
+             tol * (1 + want.size())) {
+    *expected = ShadowModel::Qty(want);
+    *actual = qty;
+    return "quantity";
+  }
+
+  for (int i = 0; i < mats.size(); ++i) {
+    if (std::abs(mats[i]->quantity() - want[i].qty) > tol) {
+      *expected = want[i].qty;
+      *actual = mats[i]->quantity();
+      return "order";
+    }
+  }
+  return "";
+}
 
 void Conditioning::RecordPosition() {
   std::string specification = this->spec();
@@ -3,12 +3,21 @@
 #ifndef CYCLUS_CONDITIONING_CONDITIONING_H_
 #define CYCLUS_CONDITIONING_CONDITIONING_H_
 
-#include <string>
+#include <deque>
 #include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "cyclus.h"
 #include "cyder_version.h"
+#include "output_buffer.h"
+#include "routing_buy_policy.h"
+#include "shadow_model.h"
+#include "step_schedule.h"
+#include "timed_policy.h"
 
 // forward declaration
 namespace conditioning {
@@ -34,13 +43,45 @@ namespace conditioning {
 ///
 /// @section agentparams Agent Parameters
 /// in_commods is a vector of strings naming the commodities that this facility receives
-/// out_commods is a string naming the commodity that in_commod is stocks into
+/// out_commods is a vector of strings naming the commodities that this facility offers
 /// residence_time is the minimum number of timesteps between receiving and offering
 /// in_recipe (optional) describes the incoming resource by recipe
 /// 
 /// @section optionalparams Optional Parameters
+/// in_commod_outs names the out_commod each in_commod is conditioned into,
+/// required when there is more than one out_commod
 /// max_inv_size is the maximum capacity of the inventory conditioning
 /// throughput is the maximum processing capacity per timestep
+/// processing_throughput and packaging_throughput limit the mass entering
+/// processing and packaging per timestep
+/// throughput_schedule, max_inv_size_schedule, processing_schedule and
+/// packaging_schedule change the corresponding limit from given times on
+/// package_capacity is the mass of material placed in each package
+/// package_fill splits and combines material into full packages instead of
+/// packing whole batches
+/// discrete_fill releases every discrete batch that fits the throughput
+/// instead of stopping at the first one that does not
+/// cache_requests reuses the previous timestep's request portfolios while
+/// the requested amount is unchanged
+/// trace_counters records per-stage transfer counts in the ConditioningTrace
+/// table each timestep
+/// record_stats records per-stage holdings, transfers and phase timings in the
+/// ConditioningStats table each timestep
+/// dense_blend combines material released in continuous mode with one
+/// composition merge per distinct composition instead of one per batch
+/// decay_on_ready decays each residence cohort once, to the current time,
+/// as it becomes ready
+/// bulk_receive receives each timestep's accepted trades at once, merging
+/// same-commodity, same-composition trades in continuous mode
+/// consolidate merges the materials that enter processing in the same
+/// timestep with identical compositions into one material per line
+/// shadow checks every Tock against a reference model of the archetype and
+/// records the first divergence in the ConditioningShadow table
+/// release_order picks which ready batches are released first when
+/// throughput binds: arrival order, input commodity preference, or batch size
+/// record_inventory records the mass held in each stage, and optionally the
+/// inventory_nuclides heaviest nuclides, in the ConditioningInventory and
+/// ConditioningNuclides tables each timestep
 ///
 /// @section detailed Detailed Behavior
 /// 
@@ -51,9 +92,59 @@ namespace conditioning {
 /// On the tock, any material that has been waiting for long enough (delay 
 /// time) is placed in the stocks buffer.
 ///
+/// A Tock in which nothing was received, nothing is ready and no cohort is
+/// due returns without visiting the buffers, so idle facilities cost almost
+/// nothing.
+///
 /// Any brand new inventory that was received in this timestep is placed into 
-/// the processing queue to begin waiting. 
+/// the processing queue to begin waiting. Materials in residence are not
+/// tracked individually: each timestep's arrivals form a cohort whose size is
+/// kept in a ring of residence_time + 1 slots, and whole cohorts are moved
+/// between buffers at once.
+///
+/// Each timestep at most processing_throughput of the received material
+/// enters processing and at most packaging_throughput of processing is
+/// packed; the rest waits for the next timestep. Residence begins once
+/// material is packed.
+///
+/// Material is packed into packages of at most package_capacity before it
+/// begins its residence time, so the cohorts ring counts packages rather
+/// than received batches. Whole batches
+/// are packed in arrival order, with a batch heavier than a package
+/// becoming a package of its own. In fill mode the arrivals are instead
+/// combined and split into full packages, with only the last package of a
+/// packing partly filled. A package_capacity of 0 leaves batches as
+/// received.
+///
+/// Each output commodity has its own line of processing, packaged, ready
+/// and stocks buffers and its own sell policy, so streams with different
+/// output commodities never mix. Received material is routed to the line of
+/// the output commodity its input commodity maps to. The lines share the
+/// packaging_throughput and throughput of a timestep; each timestep the line
+/// served first moves on by one, so a backlogged line cannot hold the
+/// others back for more than one timestep per line.
 /// 
+/// Table rows, log lines and trace lines produced during Tick and Tock are
+/// held in an agent-local buffer and written at the end of the phase, or,
+/// once defer_output(true) is set by a driver that runs agents
+/// concurrently, when the driver calls FlushOutput. Apart from that buffer,
+/// Tick and Tock read the context and change only this agent's state, so
+/// agents may run them concurrently, except when one of them
+///  - splits material: continuous handling with less throughput than is
+///    ready, or package_fill;
+///  - merges materials of different compositions: packing with a nonzero
+///    package_capacity, consolidate, or the blend made on release with
+///    continuous handling, dense_blend or not;
+///  - decays material: decay_on_ready, or a simulation that decays material
+///    lazily, where reading a composition decays the material;
+///  - sets inventory_nuclides, whose mass lookups fill the caches of
+///    compositions shared with other agents.
+/// Splits, merges and decays make resources and compositions whose ids come
+/// from counters shared by every agent, and record them through the shared
+/// context. The other options, including trace_counters, record_stats,
+/// record_inventory without nuclides, shadow, release_order and
+/// discrete_fill, are safe.
+///
 /// Making Requests:
 /// This facility requests all of the in_commod that it can.
 ///
@@ -62,7 +153,8 @@ namespace conditioning {
 /// inventory.
 ///
 /// Making Offers:
-/// Any stocks material in the stocks buffer is offered to the market.
+/// Any material in a line's stocks buffer is offered to the market as that
+/// line's output commodity.
 ///
 /// Sending Resources:
 /// Matched resources are sent immediately.
@@ -74,14 +166,20 @@ class Conditioning
   /// @param ctx the cyclus context for access to simulation-wide parameters
   Conditioning(cyclus::Context* ctx);
   
-  #pragma cyclus decl
+  #pragma cyclus decl clone
+  #pragma cyclus decl initfromcopy
+  #pragma cyclus decl initfromdb
+  #pragma cyclus decl infiletodb
+  #pragma cyclus decl schema
+  #pragma cyclus decl annotations
 
   #pragma cyclus note {"doc": "Conditioning is a simple facility which accepts any number of commodities " \
                               "and holds them for a user specified amount of time. The commodities accepted "\
                               "are chosen based on the specified preferences list. Once the desired amount of material "\
                               "has entered the facility it is passed into a 'processing' buffer where it is held until "\
                               "the residence time has passed. The material is then passed into a 'ready' buffer where it is "\
-                              "queued for removal. Currently, all input commodities are lumped into a single output commodity. "\
+                              "queued for removal. Each input commodity is conditioned into one of the output commodities, and "\
+                              "each output commodity is held and offered separately. "\
                               "Conditioning also has the functionality to handle materials in discrete or continuous batches. Discrete "\
                               "mode, which is the default, does not split or combine material batches. Continuous mode, however, "\
                               "divides material batches if necessary in order to push materials through the facility as quickly "\
@@ -102,35 +200,364 @@ class Conditioning
   /// The handleTick function specific to the Conditioning.
   virtual void Tock();
 
+  /// Writes the table rows, log lines and trace lines held since the last
+  /// flush, in the order they were produced
+  void FlushOutput();
+
+  /// Holds table rows, log lines and trace lines until FlushOutput is called instead of
+  /// writing them at the end of each Tick and Tock. For drivers that run
+  /// agents' phases concurrently and flush them in a fixed order afterwards.
+  void defer_output(bool defer) { defer_output_ = defer; }
+
+  /// Snapshots the state variables, the residence cohorts as one
+  /// (out commodity, entry time, count) row per nonempty cohort in the
+  /// Cohorts table, and the input commodities the inventory was received
+  /// under as one (position, in commodity, count) row per run of materials
+  /// in the ReceivedCommods table
+  virtual void Snapshot(cyclus::DbInit di);
+
+  /// Snapshots the inventory and every line's buffers, one inventory per
+  /// stage and output commodity
+  virtual cyclus::Inventories SnapshotInv();
+
+  /// Restores the buffers written by SnapshotInv
+  virtual void InitInv(cyclus::Inventories& inv);
+
+  /// @brief estimates the memory held by the agent's buffers, in bytes
+  ///
+  /// Keys are the inventory names used by SnapshotInv, plus "bookkeeping"
+  /// for the cohort ring and the ready indices. Each material counts its
+  /// object, its shared pointer and its ResBuf entries; each distinct
+  /// composition counts once, against the first stage holding it.
+  /// Compositions are not counted when the simulation decays material
+  /// lazily, as reading them would decay the material.
+  std::map<std::string, size_t> MemoryReport() const;
+
  protected:
+  /// @brief buffers and sell policy for the material conditioned into one
+  /// output commodity
+  struct Line {
+    Line() : ranked_qty(0) {}
+
+    /// @brief the mass ready, ranked or not
+    double ready_qty() const { return ready.quantity() + ranked_qty; }
+
+    /// @brief the number of batches ready, ranked or not
+    int ready_count() const { return ready.count() + ranked.size(); }
+
+    cyclus::toolkit::ResBuf<cyclus::Material> processing;
+    cyclus::toolkit::ResBuf<cyclus::Material> packaged;
+    cyclus::toolkit::ResBuf<cyclus::Material> ready;
+    cyclus::toolkit::ResBuf<cyclus::Material> stocks;
+
+    //// quantities of the batches in ready, in buffer order (discrete
+    //// handling of unranked batches only), so release decisions do not
+    //// have to pop and peek each batch
+    std::deque<double> ready_qtys;
+
+    //// the ready batches by release rank, lowest first, when release_order
+    //// is not fifo or discrete_fill is set (discrete handling only). Under
+    //// fifo every batch has rank 0. Ready batches are then held
+    //// here instead of in ready, so any of them can be released without
+    //// disturbing the rest; ready only holds batches restored from a
+    //// snapshot until they are ranked. Batches of equal rank are released
+    //// in the order they became ready.
+    std::multimap<double, cyclus::Material::Ptr> ranked;
+
+    //// the mass held in ranked
+    double ranked_qty;
+
+    //// A policy for sending material
+    TimedPolicy<cyclus::toolkit::MatlSellPolicy> sell_policy;
+  };
+
+  typedef cyclus::toolkit::ResBuf<cyclus::Material> Line::*Stage;
+
+  /// @brief a run of packages that entered a line's residence at the same
+  /// time
+  struct CohortRun {
+    int line;
+    int entry_time;
+    int count;
+  };
+
+  /// @brief run-length encodes the nonempty residence cohorts
+  /// @param time the current time; cohorts in the ring entered no earlier
+  /// than time - residence_time
+  /// @return one run per nonempty cohort, by line and then entry time
+  std::vector<CohortRun> CohortRuns_(int time) const;
+
+  /// @brief replaces the residence cohorts with the given runs
+  void RestoreCohorts_(const std::vector<CohortRun>& runs);
+
+  /// @brief converts the per-package entry_times list written by earlier
+  /// versions of this archetype into runs for the first line
+  static std::vector<CohortRun> EntryTimeRuns_(
+      const std::list<int>& entry_times);
+
+  /// @brief puts packaged material that no cohort counts, as restored from
+  /// a snapshot that did not record its cohort, into the cohort due now, so
+  /// that it is still released
+  void CohortUncounted_();
+
+  /// @brief a run of consecutive inventory materials received under the same
+  /// input commodity
+  struct ReceivedRun {
+    std::string in_commod;
+    int count;
+  };
+
+  /// @brief run-length encodes the input commodities of the inventory, in
+  /// inventory order
+  std::vector<ReceivedRun> ReceivedRuns_();
+
+  /// @brief replaces the input commodities of the inventory with the given
+  /// runs
+  void RestoreReceived_(const std::vector<ReceivedRun>& runs);
+
+  /// @brief restores the input commodities of the inventory from a database,
+  /// so restored material is routed to the line it was received for
+  void InitReceived_(cyclus::QueryableBackend* b);
+
+  /// @brief restores the residence cohorts from the Cohorts table of a
+  /// database, falling back to the entry_times column of the Info table
+  /// written by earlier versions
+  void InitCohorts_(cyclus::QueryableBackend* b);
+
   ///   @brief adds a material into the incoming commodity inventory
   ///   @param mat the material to add to the incoming inventory.
   ///   @throws if there is trouble with pushing to the inventory buffer.
   void AddMat_(cyclus::Material::Ptr mat);
 
-  /// @brief Move all unprocessed inventory to processing
+  /// @brief reports a throughput to the CommodityProducer, split evenly
+  /// over the output commodities
+  void SetProducerCapacity_(double capacity);
+
+  /// @brief sizes lines and the cohorts ring to match out_commods and
+  /// residence_time, leaving them untouched if they already match
+  void InitLines_();
+
+  /// @brief Move unprocessed inventory, up to the processing throughput, to
+  /// the processing buffer of the line it is routed to
   void BeginProcessing_();
 
-/// @brief move ready resources from processing to packaged after repackaging
-  /// @param *** ADD HERE ***
-  void PackageMatl_();
+  /// @brief pack up to cap of a line's processing into packages and move
+  /// them to packaged, starting their residence in the current cohort
+  /// @param l the index of the line
+  /// @param cap the mass that may be packed
+  /// @return the mass packed
+  double PackageMatl_(int l, double cap);
+
+  /// @brief pops the leading materials of a buffer whose total fits in cap
+  /// @param buf the buffer to pop from
+  /// @param cap the mass that may be popped
+  /// @param split if true the first material that does not fit is split so
+  /// that exactly cap is popped, otherwise popping stops before it
+  static std::vector<cyclus::Material::Ptr> PopUpTo_(
+      cyclus::toolkit::ResBuf<cyclus::Material>& buf, double cap, bool split);
+
+  /// @brief merges materials with the same composition into the first of
+  /// them, keeping the order of first appearance
+  std::vector<cyclus::Material::Ptr> Consolidate_(
+      const std::vector<cyclus::Material::Ptr>& mats);
+
+  /// @brief the estimated bytes held by buffered materials and by the
+  /// compositions not already in seen, which are added to it. Compositions
+  /// are left out if seen is NULL.
+  static size_t BufBytes_(const std::vector<cyclus::Material::Ptr>& mats,
+                          std::set<cyclus::Composition*>* seen);
+
+  /// @brief pack materials into packages of at most package_capacity
+  /// @param mats the materials to pack, in arrival order
+  /// @return the packages, in the order they were filled
+  std::vector<cyclus::Material::Ptr> Package_(
+      const std::vector<cyclus::Material::Ptr>& mats);
 
   /// @brief move ready resources from packaged to ready at a certain time
+  /// @param l the index of the line
   /// @param time the time of interest
-  void ReadyMatl_(int time);
+  void ReadyMatl_(int l, int time);
+
+  /// @brief decay materials to the current time with Material::Decay, which
+  /// advances each material's last decay time so no later decay repeats it
+  /// @param mats the materials to decay
+  void DecayCohort_(const std::vector<cyclus::Material::Ptr>& mats);
 
-  /// @brief Move as many ready resources as allowable into stocks
+  /// @brief Move as many ready resources as allowable into stocks, serving
+  /// lines in out_commods order from first_line_()
   /// @param cap current throughput capacity 
   void ProcessMat_(double cap);
 
+  /// @brief move the leading ready batches whose total fits in max_pop into
+  /// stocks with a single PopN
+  /// @param line the line to release from
+  /// @param max_pop the mass that may be moved this timestep
+  void ReleaseDiscrete_(Line& line, double max_pop);
+
+  /// @brief move ranked batches into stocks in release_order rank, taking
+  /// each one out of the line's ranked index and leaving the rest in place
+  /// @param line the line to release from
+  /// @param max_pop the mass that may be moved this timestep
+  void ReleaseRanked_(Line& line, double max_pop);
+
+  /// @brief rebuild a line's ready_qtys if it no longer mirrors its ready
+  /// buffer, e.g. after a restart from a snapshot
+  /// @param line the line to check
+  void SyncReadyQtys_(Line& line);
+
+  /// @brief move the batches held in a line's ready buffer, e.g. after a
+  /// restart from a snapshot, into its ranked index
+  /// @param line the line to rank
+  void RankReady_(Line& line);
+
+  /// @brief the release rank of a ready batch under release_order, lower
+  /// ranks are released first
+  double Rank_(cyclus::Material::Ptr mat) const;
+
+  /// @brief the preference of an input commodity, kDefaultPref if unknown
+  double PrefOf_(const std::string& in_commod) const;
+
+  /// @brief raises the preference of the batch with obj_id to to that of
+  /// the batch with obj_id from, if it is higher. Used as batches are packed
+  /// together; does nothing unless release_order is priority.
+  void InheritPref_(int to, int from);
+
+  /// @brief pops qty from the front of a buffer as a single material, like
+  /// ResBuf::Pop(qty, eps), but combines the popped batches with Blend_
+  /// @param buf the buffer to pop from
+  /// @param qty the mass to pop, at most buf.quantity()
+  static cyclus::Material::Ptr PopBlend_(
+      cyclus::toolkit::ResBuf<cyclus::Material>& buf, double qty);
+
+  /// @brief combines materials into the first one with one composition
+  /// merge per distinct composition rather than per batch. Batches sharing a
+  /// composition are absorbed into the first of them, which needs no merge,
+  /// then the groups are absorbed together in order of first appearance.
+  /// Every step is a plain Absorb, so the Resources table records only the
+  /// merges that took place.
+  /// @param mats the materials to combine, not empty
+  /// @return the combined material
+  static cyclus::Material::Ptr Blend_(
+      const std::vector<cyclus::Material::Ptr>& mats);
+
+  /// @brief checks that the incrementally maintained bookkeeping (cohorts
+  /// ring and ready_qtys) agrees with the buffer contents. Masses agree to
+  /// within eps_rsrc per kilogram held. Only called in debug builds
+  /// (CYDER_DEBUG).
+  /// @throws cyclus::StateError if they disagree
+  void CheckTotals_();
+
+  /// @brief records this timestep's per-stage transfer counts in the
+  /// ConditioningTrace table
+  void RecordTrace_();
+
+  /// @brief records this timestep's buffer holdings, transfers and phase
+  /// timings in the ConditioningStats table
+  /// @param tock_time wall-clock seconds spent in the current Tock
+  void RecordStats_(double tock_time);
+
+  /// @brief records the mass held in each stage in the
+  /// ConditioningInventory table, and the masses of the inventory_nuclides
+  /// heaviest nuclides held in the ConditioningNuclides table, one row per
+  /// nuclide
+  void RecordInventory_();
+
+  /// @brief adds the mass of each nuclide held in materials to totals
+  static void AddNuclides_(const std::vector<cyclus::Material::Ptr>& mats,
+                           cyclus::CompMap& totals);
+
+  /// @brief the materials held in a buffer, in buffer order. Pops them
+  /// from a copy, so the buffer itself is left untouched.
+  static std::vector<cyclus::Material::Ptr> Contents_(
+      const cyclus::toolkit::ResBuf<cyclus::Material>& buf);
+
+  /// @brief the materials held in a line's stage. Ready batches are listed
+  /// ranked first, in rank order, then those not yet ranked.
+  std::vector<cyclus::Material::Ptr> StageContents_(int l, Stage stage) const;
+
+  /// @brief the line served first from the capacities the lines share in
+  /// this timestep. It rotates with time, round robin.
+  int first_line_() const;
+
+  /// @brief whether the simulation decays material lazily, i.e. whenever
+  /// its composition is read. Reports then leave compositions unread, so
+  /// observing the agent never decays or records its material.
+  bool lazy_decay_() const;
+
+  /// @brief copies the state a Tock starts from into a reference model.
+  /// Under lazy decay every batch gets composition id 0.
+  void SeedShadow_(ShadowModel& model);
+
+  /// @brief the settings and limits of a Tock at the current time
+  ShadowModel::Params ShadowParams_() const;
+
+  /// @brief compares every buffer's count, mass and batch order with a
+  /// reference model, recording the first divergence in the
+  /// ConditioningShadow table
+  /// @return whether the buffers match
+  bool CheckShadow_(const ShadowModel& model);
+
+  /// @brief compares the materials of one buffer, in buffer order, with its
+  /// counterpart in a reference model
+  /// @return a description of the first difference, empty if none
+  static std::string CompareShadow_(
+      const std::vector<cyclus::Material::Ptr>& mats,
+      const ShadowModel::Stage& want, double* expected, double* actual);
+
     /* --- Conditioning Members --- */
 
-  /// @brief current maximum amount that can be added to processing
+  /// @brief current maximum amount that can be added to processing. ResBuf
+  /// keeps a running total of its contents, so this is O(1) per line
+  /// regardless of how many materials are held
   inline double current_capacity() const { 
-    return (max_inv_size - processing.quantity() - stocks.quantity()); }
+    return (max_inv_size_at(now()) -
+            StageQty_(&Line::processing) -
+            StageQty_(&Line::stocks)); }
+
+  /// @brief true if the current Tock has nothing to do: nothing was
+  /// received, no line has ready material and no cohort is due
+  inline bool idle() const {
+    return inventory.empty() && now() < next_due &&
+           StageCount_(&Line::processing) == 0 &&
+           StageCount_(&Line::ready) == 0; }
+
+  /// @brief the earliest time a cohort still in residence is due to be
+  /// moved to ready, INT_MAX if none is
+  int NextDue_() const;
+
+  /// @brief total quantity held in a stage across all lines, ranked batches
+  /// counting as ready
+  double StageQty_(Stage stage) const;
+
+  /// @brief total number of resources held in a stage across all lines,
+  /// ranked batches counting as ready
+  int StageCount_(Stage stage) const;
+
+  /// @brief returns the line for an input commodity, the first line if the
+  /// commodity is unknown
+  int LineOf_(const std::string& in_commod) const;
+
+  /// @brief returns the name a line's stage is snapshotted under
+  std::string InvName_(const std::string& stage, int l) const;
+
+  /// @brief the current simulation time. Virtual so that tests can step the
+  /// stages through time without running a simulation.
+  virtual int now() const { return context()->time(); }
 
   /// @brief returns the time key for ready materials
-  int ready_time(){ return context()->time() - residence_time; }
+  int ready_time(){ return now() - residence_time; }
+
+  /// @brief true if ready batches are held in each line's ranked index and
+  /// released by rank, which is when a release may skip batches
+  inline bool ranked_release() const {
+    return discrete_handling && (release_order != "fifo" || discrete_fill); }
+
+  /// @brief returns the cohorts ring slot for materials entering a line at a
+  /// time
+  /// @param l the index of the line
+  /// @param time the entry time of the cohort
+  inline int cohort_slot(int l, int time) const {
+    return l * (residence_time + 1) + time % (residence_time + 1); }
 
   /* --- Module Members --- */
 
@@ -149,12 +576,20 @@ class Conditioning
   std::vector<double> in_commod_prefs;
 
   #pragma cyclus var {"tooltip":"output commodity",\
-                      "doc":"commodity produced by this facility. Multiple commodity tracking is"\
-                      " currently not supported, one output commodity catches all input commodities.",\
+                      "doc":"commodities produced by this facility. Each output commodity is held "\
+                      "and offered separately, see in_commod_outs.",\
                       "uilabel":"Output Commodities",\
                       "uitype":["oneormore","outcommodity"]}
   std::vector<std::string> out_commods;
 
+  #pragma cyclus var {"default": [],\
+                      "doc":"the output commodity each of the given input commodities is conditioned "\
+                      "into, in the same order. Every value must be one of out_commods. May be "\
+                      "omitted when there is a single output commodity.",\
+                      "uilabel":"Output Commodity of each Input Commodity", \
+                      "uitype":["oneormore", "outcommodity"]}
+  std::vector<std::string> in_commod_outs;
+
   #pragma cyclus var {"default":"",\
                       "tooltip":"input recipe",\
                       "doc":"recipe accepted by this facility, if unspecified a dummy recipe is used",\
@@ -189,40 +624,290 @@ class Conditioning
                       "units":"kg"}
   double max_inv_size; 
 
+  #pragma cyclus var {"default": 1e299,\
+                      "tooltip":"processing throughput per timestep (kg)",\
+                      "doc":"the max amount of received material that can enter processing per "\
+                            "timestep (kg). Material that does not fit waits in the inventory.",\
+                      "uilabel":"Processing Throughput",\
+                      "uitype": "range", \
+                      "range": [0.0, 1e299], \
+                      "units":"kg"}
+  double processing_throughput;
+
+  #pragma cyclus var {"default": 1e299,\
+                      "tooltip":"packaging throughput per timestep (kg)",\
+                      "doc":"the max amount of material that can be packed per timestep (kg). "\
+                            "Material that does not fit waits in processing.",\
+                      "uilabel":"Packaging Throughput",\
+                      "uitype": "range", \
+                      "range": [0.0, 1e299], \
+                      "units":"kg"}
+  double packaging_throughput;
+
+  #pragma cyclus var {"default": {},\
+                      "tooltip":"throughput schedule",\
+                      "doc":"changes to throughput, keyed by the timestep from which each new "\
+                            "value holds until the next change. throughput applies before the "\
+                            "first change.",\
+                      "uilabel":"Throughput Schedule",\
+                      "units":"kg"}
+  std::map<int, double> throughput_schedule;
+
+  #pragma cyclus var {"default": {},\
+                      "tooltip":"maximum inventory size schedule",\
+                      "doc":"changes to max_inv_size, keyed by the timestep from which each new "\
+                            "value holds until the next change. max_inv_size applies before the "\
+                            "first change.",\
+                      "uilabel":"Maximum Inventory Size Schedule",\
+                      "units":"kg"}
+  std::map<int, double> max_inv_size_schedule;
+
+  #pragma cyclus var {"default": {},\
+                      "tooltip":"processing throughput schedule",\
+                      "doc":"changes to processing_throughput, keyed by the timestep from which "\
+                            "each new value holds until the next change. processing_throughput "\
+                            "applies before the first change.",\
+                      "uilabel":"Processing Throughput Schedule",\
+                      "units":"kg"}
+  std::map<int, double> processing_schedule;
+
+  #pragma cyclus var {"default": {},\
+                      "tooltip":"packaging throughput schedule",\
+                      "doc":"changes to packaging_throughput, keyed by the timestep from which "\
+                            "each new value holds until the next change. packaging_throughput "\
+                            "applies before the first change.",\
+                      "uilabel":"Packaging Throughput Schedule",\
+                      "units":"kg"}
+  std::map<int, double> packaging_schedule;
+
   #pragma cyclus var {"default": False,\
                       "tooltip":"Bool to determine how Conditioning handles batches",\
                       "doc":"Determines if Conditioning will divide resource objects. Only controls material "\
                             "handling within this facility, has no effect on DRE material handling. "\
                             "If true, batches are handled as discrete quanta, neither split nor combined. "\
+                            "Packing (package_capacity, package_fill) and consolidate still combine, "\
+                            "and in fill mode split, batches as they enter processing; the packages "\
+                            "they make are then handled as discrete quanta. "\
                             "Otherwise, batches may be divided during processing. Default to false (continuous))",\
                       "uilabel":"Batch Handling"}
   bool discrete_handling;                    
 
-  #pragma cyclus var {"tooltip":"Incoming material buffer"}
-  cyclus::toolkit::ResBuf<cyclus::Material> inventory;
+  #pragma cyclus var {"default": 0,\
+                      "tooltip":"package capacity (kg)",\
+                      "doc":"the maximum mass of material placed in each package (kg). Each "\
+                            "timestep's arrivals are packed before their residence time begins. "\
+                            "Default to 0, which leaves batches as received.",\
+                      "uilabel":"Package Capacity",\
+                      "uitype": "range", \
+                      "range": [0.0, 1e299], \
+                      "units":"kg"}
+  double package_capacity;
 
-  #pragma cyclus var {"tooltip":"Output material buffer"}
-  cyclus::toolkit::ResBuf<cyclus::Material> stocks;
+  #pragma cyclus var {"default": False,\
+                      "tooltip":"Fill packages to capacity",\
+                      "doc":"Only used with a nonzero package_capacity. If true, arrivals are "\
+                            "combined and split so that every package but the last of a timestep "\
+                            "holds exactly package_capacity. Otherwise whole batches are packed in "\
+                            "arrival order without being split. Applies with discrete handling too. "\
+                            "Default to false.",\
+                      "uilabel":"Package Fill"}
+  bool package_fill;
 
-  #pragma cyclus var {"tooltip":"Buffer for material held for required residence_time"}
-  cyclus::toolkit::ResBuf<cyclus::Material> ready;
+  #pragma cyclus var {"default": False,\
+                      "tooltip":"Fill throughput with whole batches",\
+                      "doc":"Only used with discrete handling. If true, every ready batch that fits in "\
+                            "the remaining throughput is moved to stocks, even when an earlier batch "\
+                            "does not fit. Otherwise batches are released in arrival order and release "\
+                            "stops at the first batch that does not fit. Default to false.",\
+                      "uilabel":"Discrete Fill"}
+  bool discrete_fill;
+
+  #pragma cyclus var {"default": False,\
+                      "tooltip":"Blend released material densely",\
+                      "doc":"Only used with continuous handling. If true, the batches moved to "\
+                            "stocks each timestep are first combined with the others of the same "\
+                            "composition, which needs no merge, and the resulting groups are then "\
+                            "merged, so compositions are merged once per distinct composition "\
+                            "instead of once per batch. The combined nuclide masses agree with a "\
+                            "batch by batch merge to within eps_rsrc. Default to false.",\
+                      "uilabel":"Dense Blend"}
+  bool dense_blend;
 
-  //// list of input times for materials entering the processing buffer
-  #pragma cyclus var{"default": [],\
-                      "internal": True}
-  std::list<int> entry_times;
+  #pragma cyclus var {"default": False,\
+                      "tooltip":"Decay material over its residence",\
+                      "doc":"If true, the material in each residence cohort is decayed once, "\
+                            "from the last time it was decayed to the current time, as the "\
+                            "cohort becomes ready. Ignored when the simulation decays material "\
+                            "lazily, as material is then already decayed whenever its "\
+                            "composition is read, and does nothing when it never decays "\
+                            "material. Default to false.",\
+                      "uilabel":"Decay On Ready"}
+  bool decay_on_ready;
+
+  #pragma cyclus var {"default": "fifo",\
+                      "tooltip":"Order ready batches are released in",\
+                      "doc":"Only used with discrete handling. One of fifo, priority, largest or "\
+                            "smallest. fifo releases ready batches in arrival order. priority "\
+                            "releases batches of the most preferred input commodity, per "\
+                            "in_commod_prefs, first and in arrival order within a preference; a "\
+                            "package takes the highest preference of the batches packed into it. "\
+                            "largest releases the largest batch that fits in the remaining "\
+                            "throughput, repeatedly, to fill throughput. smallest releases the "\
+                            "smallest batches first. discrete_fill applies to fifo and priority. "\
+                            "Preferences of batches in residence are not snapshotted, so after "\
+                            "a restart they are released at the default preference. Default "\
+                            "to fifo.",\
+                      "uilabel":"Release Order"}
+  std::string release_order;
 
-  #pragma cyclus var {"tooltip":"Buffer for material still waiting for required residence_time"}
-  cyclus::toolkit::ResBuf<cyclus::Material> processing;
+  #pragma cyclus var {"default": False,\
+                      "tooltip":"Receive each timestep's trades at once",\
+                      "doc":"If true, the materials accepted in a timestep are received "\
+                            "together, checking the inventory's capacity once, and an error is "\
+                            "raised if they do not fit. With continuous handling, materials "\
+                            "traded under the same commodity with the same composition are also "\
+                            "merged into one material as they are received, so the inventory "\
+                            "holds one material per stream instead of one per trade. With "\
+                            "discrete handling materials are still pushed one trade at a time. "\
+                            "Default to false.",\
+                      "uilabel":"Bulk Receive"}
+  bool bulk_receive;
 
-    #pragma cyclus var {"tooltip":"Buffer for material that just got packaged and are still waiting for required residence time "}
-  cyclus::toolkit::ResBuf<cyclus::Material> packaged;
+  #pragma cyclus var {"default": False,\
+                      "tooltip":"Merge identical materials entering processing",\
+                      "doc":"If true, the materials that enter processing on a line in the same "\
+                            "timestep and share a composition are merged into one material, so "\
+                            "each is held as one resource for its whole residence. With discrete "\
+                            "handling the merged material is then handled as a single batch. "\
+                            "Default to false.",\
+                      "uilabel":"Consolidate"}
+  bool consolidate;
 
-  //// A policy for requesting material
-  cyclus::toolkit::MatlBuyPolicy buy_policy;
+  #pragma cyclus var {"default": False,\
+                      "tooltip":"Reuse unchanged request portfolios",\
+                      "doc":"If true, the request portfolios built for a timestep are reused on "\
+                            "later timesteps as long as the requested amount has not changed, "\
+                            "and no requests are made while there is no room for material. "\
+                            "Default to false.",\
+                      "uilabel":"Cache Requests"}
+  bool cache_requests;
 
-  //// A policy for sending material
-  cyclus::toolkit::MatlSellPolicy sell_policy;
+  #pragma cyclus var {"default": False,\
+                      "tooltip":"Record per-stage transfer counts",\
+                      "doc":"If true, the number of resources moved into processing, packaged, "\
+                            "ready and stocks is recorded every timestep in the ConditioningTrace "\
+                            "table. Default to false.",\
+                      "uilabel":"Trace Counters"}
+  bool trace_counters;
+
+  #pragma cyclus var {"default": False,\
+                      "tooltip":"Record per-stage statistics",\
+                      "doc":"If true, the quantity and count held in each buffer, the mass moved "\
+                            "between stages and the wall-clock time spent in Tick, Tock, "\
+                            "ProcessMat_ and the trading policies are recorded every timestep "\
+                            "in the ConditioningStats table. Default to false.",\
+                      "uilabel":"Record Statistics"}
+  bool record_stats;
+
+  #pragma cyclus var {"default": False,\
+                      "tooltip":"Record per-stage inventory",\
+                      "doc":"If true, the mass held in each buffer stage is recorded every "\
+                            "timestep in the ConditioningInventory table, one row per timestep. "\
+                            "This is a much smaller alternative to explicit_inventory for "\
+                            "following holdings over time. Default to false.",\
+                      "uilabel":"Record Inventory"}
+  bool record_inventory;
+
+  #pragma cyclus var {"default": 0,\
+                      "tooltip":"nuclides in the inventory table",\
+                      "doc":"Only used with record_inventory. The number of nuclides whose total "\
+                            "mass over all buffers is recorded each timestep, heaviest first, "\
+                            "in the ConditioningNuclides table, one row (AgentId, Time, Rank, "\
+                            "Nuc, Qty) per nuclide. Finding the nuclides visits every material "\
+                            "held, so keep this 0 unless the nuclide series is needed. When the "\
+                            "simulation decays material lazily, reading compositions would decay "\
+                            "it, so no nuclides are recorded. Default to 0.",\
+                      "uilabel":"Inventory Nuclides",\
+                      "uitype": "range", \
+                      "range": [0, 100]}
+  int inventory_nuclides;
+
+  #pragma cyclus var {"default": False,\
+                      "tooltip":"Check each Tock against a reference model",\
+                      "doc":"If true, every Tock is repeated on a copy of the facility's state by "\
+                            "a simple reference model of the archetype, and the count, mass and "\
+                            "order of the batches in each buffer are compared with it afterwards. "\
+                            "The first divergence is recorded in the ConditioningShadow table and "\
+                            "logged as an error. Copying the state visits every material held, so "\
+                            "use this to validate settings, not in production runs. Building with "\
+                            "-DCYDER_SHADOW=ON turns this on for every facility. Skipped when the "\
+                            "simulation decays material lazily and consolidate is set, as the "\
+                            "model then cannot read compositions. Default to false.",\
+                      "uilabel":"Shadow"}
+  bool shadow;
+
+  /// @brief resources and mass moved into a stage during one Tock
+  struct Transfer {
+    Transfer() : count(0), qty(0) {}
+    int count;
+    double qty;
+  };
+
+  //// transfers into each stage during the current Tock
+  Transfer to_processing;
+  Transfer to_packaged;
+  Transfer to_ready;
+  Transfer to_stocks;
+
+  //// wall-clock seconds spent in this timestep's Tick and ProcessMat_
+  double tick_time;
+  double process_time;
+
+  //// limits in effect at each time, tabulated from the scalar limits and
+  //// their schedules in EnterNotify
+  StepSchedule throughput_at;
+  StepSchedule max_inv_size_at;
+  StepSchedule processing_at;
+  StepSchedule packaging_at;
+
+  //// throughput last reported to the CommodityProducer, over all output
+  //// commodities
+  double producer_capacity;
+
+  //// rows, log lines and trace lines produced since the last flush
+  OutputBuffer output_;
+
+  //// whether Tick and Tock leave flushing output_ to the caller
+  bool defer_output_;
+
+  //// earliest time a cohort in residence is due, recomputed after every
+  //// Tock that does work. Starts at 0 so the first Tock after construction
+  //// or a restart always runs in full.
+  int next_due;
+
+  //// whether a divergence from the shadow model has been recorded
+  bool shadow_diverged;
+
+  //// Incoming material buffer, shared by all lines
+  cyclus::toolkit::ResBuf<cyclus::Material> inventory;
+
+  //// one line per output commodity, in out_commods order
+  std::vector<Line> lines;
+
+  //// line index of each input commodity
+  std::map<std::string, int> in_commod_lines;
+
+  //// rings of residence cohorts, one per line. The number of packages that
+  //// entered line l's residence at time t is held in cohort_slot(l, t).
+  //// Snapshotted run-length encoded, see Snapshot.
+  std::vector<int> cohorts;
+
+  //// preference of each batch in processing or packaged, by obj_id, kept
+  //// only with release_order priority
+  std::map<int, double> batch_prefs;
+
+  //// A policy for requesting material
+  TimedPolicy<RoutingBuyPolicy> buy_policy;
 
   #pragma cyclus var { \
     "default": 0.0, \
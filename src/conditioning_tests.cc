@@ -0,0 +1,1067 @@
+#include "conditioning_tests.h"
+
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <typeinfo>
+
+#include "sqlite_back.h"
+
+namespace conditioning {
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void ConditioningTest::TearDown() {
+  for (int i = 0; i < facs_.size(); ++i) {
+    delete facs_[i];
+  }
+  facs_.clear();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ClockedConditioning* ConditioningTest::NewConditioning(
+    int residence_time, const std::vector<std::string>& out_commods) {
+  ClockedConditioning* fac = new ClockedConditioning(tc_.get());
+  facs_.push_back(fac);
+  fac->in_commods.push_back("waste");
+  fac->out_commods = out_commods;
+  fac->residence_time = residence_time;
+  fac->discrete_handling = true;
+  fac->InitLines_();
+  return fac;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void ConditioningTest::Enter(Conditioning* fac, int l, int time, int n) {
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+  for (int i = 0; i < n; ++i) {
+    fac->lines[l].packaged.Push(cyclus::Material::CreateUntracked(10, c));
+  }
+  fac->cohorts[fac->cohort_slot(l, time)] += n;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void ConditioningTest::CopyInv(Conditioning* src, Conditioning* dst) {
+  cyclus::Inventories invs = src->SnapshotInv();
+  dst->InitInv(invs);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void ConditioningTest::Accept(Conditioning* fac,
+                              const std::vector<cyclus::Material::Ptr>& mats,
+                              const std::vector<std::string>& in_commods) {
+  using cyclus::Material;
+  using cyclus::Request;
+  using cyclus::Trade;
+
+  std::vector<Request<Material>*> reqs;
+  std::vector<std::pair<Trade<Material>, Material::Ptr> > resps;
+  for (int i = 0; i < mats.size(); ++i) {
+    reqs.push_back(Request<Material>::Create(mats[i], fac, in_commods[i]));
+    resps.push_back(std::make_pair(
+        Trade<Material>(reqs.back(), NULL, mats[i]->quantity()), mats[i]));
+  }
+  fac->buy_policy.AcceptMatlTrades(resps);
+  for (int i = 0; i < reqs.size(); ++i) {
+    delete reqs[i];
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::vector<cyclus::Material::Ptr> ConditioningTest::Stocks(
+    Conditioning* fac, int l) {
+  cyclus::toolkit::ResBuf<cyclus::Material>& stocks = fac->lines[l].stocks;
+  std::vector<cyclus::Material::Ptr> mats = stocks.PopN(stocks.count());
+  stocks.Push(mats);
+  return mats;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double ConditioningTest::Held(Conditioning* fac) {
+  return fac->inventory.quantity() +
+         fac->StageQty_(&Conditioning::Line::processing) +
+         fac->StageQty_(&Conditioning::Line::packaged) +
+         fac->StageQty_(&Conditioning::Line::ready) +
+         fac->StageQty_(&Conditioning::Line::stocks);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::string ConditioningTest::Digest(Conditioning* fac) {
+  std::stringstream ss;
+  ss << fac->inventory.count() << " " << fac->inventory.quantity();
+  for (int l = 0; l < fac->lines.size(); ++l) {
+    Conditioning::Line& line = fac->lines[l];
+    ss << " | " << line.processing.count() << " " << line.packaged.count()
+       << " " << line.ready_count() << " " << line.stocks.count() << " "
+       << line.stocks.quantity();
+  }
+
+  const std::deque<OutputBuffer::Row>& rows = fac->output_.rows();
+  for (int i = 0; i < rows.size(); ++i) {
+    ss << "\n" << rows[i].title();
+    for (int j = 0; j < rows[i].vals().size(); ++j) {
+      std::string field = rows[i].vals()[j].first;
+      const boost::spirit::hold_any& val = rows[i].vals()[j].second;
+      if (field == "AgentId") {
+        continue;
+      } else if (field != "Time" && field.size() > 4 &&
+                 field.compare(field.size() - 4, 4, "Time") == 0) {
+        // wall-clock timings differ from run to run
+        continue;
+      } else if (val.type() == typeid(int)) {
+        ss << " " << field << "=" << boost::spirit::any_cast<int>(val);
+      } else if (val.type() == typeid(double)) {
+        ss << " " << field << "=" << boost::spirit::any_cast<double>(val);
+      }
+    }
+  }
+  return ss.str();
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, CohortRunsEncodeNonemptyCohorts) {
+  Conditioning* fac = NewConditioning(4, std::vector<std::string>(1, "out"));
+  Enter(fac, 0, 7, 2);
+  Enter(fac, 0, 8, 1);
+  Enter(fac, 0, 10, 3);
+
+  std::vector<CohortRun> runs = Runs(fac, 10);
+  ASSERT_EQ(3, runs.size());
+  EXPECT_EQ(7, runs[0].entry_time);
+  EXPECT_EQ(2, runs[0].count);
+  EXPECT_EQ(8, runs[1].entry_time);
+  EXPECT_EQ(1, runs[1].count);
+  EXPECT_EQ(10, runs[2].entry_time);
+  EXPECT_EQ(3, runs[2].count);
+  for (int i = 0; i < runs.size(); ++i) {
+    EXPECT_EQ(0, runs[i].line);
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, RestoredCohortsReleaseIdentically) {
+  int residence_time = 4;
+  std::vector<std::string> out_commods(1, "out");
+  Conditioning* src = NewConditioning(residence_time, out_commods);
+  Enter(src, 0, 7, 2);
+  Enter(src, 0, 8, 1);
+  Enter(src, 0, 10, 3);
+
+  Conditioning* dst = NewConditioning(residence_time, out_commods);
+  Restore(dst, Runs(src, 10));
+  CopyInv(src, dst);
+  EXPECT_EQ(Cohorts(src), Cohorts(dst));
+
+  for (int t = 11; t <= 15; ++t) {
+    Ready(src, 0, t - residence_time);
+    Ready(dst, 0, t - residence_time);
+    EXPECT_EQ(ReadyCount(src, 0), ReadyCount(dst, 0)) << "at t=" << t;
+  }
+  EXPECT_EQ(6, ReadyCount(dst, 0));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, RestoredCohortsKeepTheirLine) {
+  int residence_time = 2;
+  std::vector<std::string> out_commods;
+  out_commods.push_back("a");
+  out_commods.push_back("b");
+  Conditioning* src = NewConditioning(residence_time, out_commods);
+  Enter(src, 0, 5, 1);
+  Enter(src, 1, 5, 2);
+  Enter(src, 1, 6, 4);
+
+  Conditioning* dst = NewConditioning(residence_time, out_commods);
+  Restore(dst, Runs(src, 6));
+  CopyInv(src, dst);
+  EXPECT_EQ(Cohorts(src), Cohorts(dst));
+
+  for (int t = 7; t <= 8; ++t) {
+    for (int l = 0; l < 2; ++l) {
+      Ready(src, l, t - residence_time);
+      Ready(dst, l, t - residence_time);
+      EXPECT_EQ(ReadyCount(src, l), ReadyCount(dst, l))
+          << "line " << l << " at t=" << t;
+    }
+  }
+  EXPECT_EQ(1, ReadyCount(dst, 0));
+  EXPECT_EQ(6, ReadyCount(dst, 1));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, LegacyEntryTimesRestore) {
+  std::vector<std::string> out_commods(1, "out");
+  Conditioning* src = NewConditioning(4, out_commods);
+  Enter(src, 0, 7, 2);
+  Enter(src, 0, 8, 1);
+  Enter(src, 0, 10, 3);
+
+  std::list<int> entry_times;
+  entry_times.push_back(7);
+  entry_times.push_back(7);
+  entry_times.push_back(8);
+  entry_times.push_back(10);
+  entry_times.push_back(10);
+  entry_times.push_back(10);
+  std::vector<CohortRun> runs = EntryTimeRuns(entry_times);
+  EXPECT_EQ(3, runs.size());
+
+  Conditioning* dst = NewConditioning(4, out_commods);
+  Restore(dst, runs);
+  EXPECT_EQ(Cohorts(src), Cohorts(dst));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, PackagesWithoutACohortAreReleased) {
+  int residence_time = 4;
+  std::vector<std::string> out_commods(1, "out");
+  Conditioning* src = NewConditioning(residence_time, out_commods);
+  Enter(src, 0, 3, 2);
+
+  // a snapshot that did not record the cohort restores only the packages
+  ClockedConditioning* dst = NewConditioning(residence_time, out_commods);
+  dst->time = 5;
+  CopyInv(src, dst);
+  Ready(dst, 0, dst->time - residence_time);
+  EXPECT_EQ(2, ReadyCount(dst, 0));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, TradedCommoditiesKeepTheirLineAcrossARestart) {
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+
+  std::vector<std::string> out_commods;
+  out_commods.push_back("a");
+  out_commods.push_back("b");
+  ClockedConditioning* facs[2];
+  for (int k = 0; k < 2; ++k) {
+    facs[k] = NewConditioning(0, out_commods);
+    facs[k]->in_commods.push_back("hot");
+    facs[k]->in_commod_outs = out_commods;
+    facs[k]->processing_throughput = 6;
+    facs[k]->EnterNotify();
+  }
+  ClockedConditioning* src = facs[0];
+  ClockedConditioning* dst = facs[1];
+
+  // waste batches weigh 1, 3 and 5 kg, hot ones 2, 4 and 6 kg
+  std::vector<cyclus::Material::Ptr> mats;
+  std::vector<std::string> in_commods;
+  for (int i = 0; i < 6; ++i) {
+    mats.push_back(cyclus::Material::CreateUntracked(1 + i, c));
+    in_commods.push_back(i % 2 ? "hot" : "waste");
+  }
+  Accept(src, mats, in_commods);
+  src->Tock();
+  ASSERT_EQ(3, InventoryCount(src));
+
+  // restart the rest of the inventory in dst, then run both
+  CopyInv(src, dst);
+  CopyReceived(src, dst);
+  EXPECT_EQ(Received(src), Received(dst));
+  for (int t = 1; t < 5; ++t) {
+    src->time = t;
+    dst->time = t;
+    src->Tock();
+    dst->Tock();
+  }
+
+  // dst holds the batches restored into its inventory, each on its line
+  std::vector<cyclus::Material::Ptr> a = Stocks(dst, 0);
+  std::vector<cyclus::Material::Ptr> b = Stocks(dst, 1);
+  ASSERT_EQ(1, a.size());
+  EXPECT_DOUBLE_EQ(5, a[0]->quantity());
+  ASSERT_EQ(2, b.size());
+  EXPECT_DOUBLE_EQ(4, b[0]->quantity());
+  EXPECT_DOUBLE_EQ(6, b[1]->quantity());
+  EXPECT_EQ(3, Stocks(src, 0).size());
+  EXPECT_EQ(3, Stocks(src, 1).size());
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, ProducerCapacityIsSharedByTheLines) {
+  std::vector<std::string> out_commods;
+  out_commods.push_back("a");
+  out_commods.push_back("b");
+  ClockedConditioning* fac = NewConditioning(0, out_commods);
+  fac->throughput = 10;
+  fac->throughput_schedule[0] = 6;
+  fac->EnterNotify();
+  fac->Tick();
+
+  cyclus::toolkit::Commodity a("a");
+  cyclus::toolkit::Commodity b("b");
+  EXPECT_DOUBLE_EQ(3, fac->Capacity(a));
+  EXPECT_DOUBLE_EQ(3, fac->Capacity(b));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, BackloggedLineDoesNotStarveTheOthers) {
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+
+  std::vector<std::string> out_commods;
+  out_commods.push_back("a");
+  out_commods.push_back("b");
+  ClockedConditioning* fac = NewConditioning(0, out_commods);
+  fac->in_commods.push_back("hot");
+  fac->in_commod_outs = out_commods;
+  fac->throughput = 10;
+  fac->EnterNotify();
+
+  // line a holds more than a timestep's throughput, line b a small batch
+  std::vector<cyclus::Material::Ptr> mats;
+  std::vector<std::string> in_commods;
+  for (int i = 0; i < 4; ++i) {
+    mats.push_back(cyclus::Material::CreateUntracked(10, c));
+    in_commods.push_back("waste");
+  }
+  mats.push_back(cyclus::Material::CreateUntracked(2, c));
+  in_commods.push_back("hot");
+  Accept(fac, mats, in_commods);
+
+  fac->Tock();
+  EXPECT_EQ(1, Stocks(fac, 0).size());
+  EXPECT_EQ(0, Stocks(fac, 1).size());
+
+  // line b is served first in the next timestep
+  fac->time = 1;
+  fac->Tock();
+  EXPECT_EQ(1, Stocks(fac, 0).size());
+  EXPECT_EQ(1, Stocks(fac, 1).size());
+
+  fac->time = 2;
+  fac->Tock();
+  EXPECT_EQ(2, Stocks(fac, 0).size());
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, CachedRequestsFollowTheRequestedAmount) {
+  typedef std::set<cyclus::RequestPortfolio<cyclus::Material>::Ptr> Ports;
+  ClockedConditioning* fac =
+      NewConditioning(0, std::vector<std::string>(1, "out"));
+  fac->max_inv_size = 100;
+  fac->cache_requests = true;
+  fac->EnterNotify();
+  fac->Tick();
+
+  Ports first = Requests(fac);
+  ASSERT_EQ(1, first.size());
+  EXPECT_DOUBLE_EQ(100, (*first.begin())->qty());
+  EXPECT_TRUE(first == Requests(fac));
+
+  // receiving material lowers the space left, so the requests are rebuilt
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  Receive(fac, cyclus::Material::CreateUntracked(
+                   10, cyclus::Composition::CreateFromMass(v)));
+  Ports second = Requests(fac);
+  ASSERT_EQ(1, second.size());
+  EXPECT_FALSE(first == second);
+  EXPECT_DOUBLE_EQ(90, (*second.begin())->qty());
+  EXPECT_TRUE(second == Requests(fac));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, PackageFillSplitsIntoFullPackages) {
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+  ClockedConditioning* fac =
+      NewConditioning(0, std::vector<std::string>(1, "out"));
+  fac->package_capacity = 4;
+  fac->package_fill = true;
+
+  std::vector<cyclus::Material::Ptr> mats;
+  mats.push_back(cyclus::Material::CreateUntracked(3, c));
+  mats.push_back(cyclus::Material::CreateUntracked(3, c));
+  mats.push_back(cyclus::Material::CreateUntracked(5, c));
+  std::vector<cyclus::Material::Ptr> pkgs = Package(fac, mats);
+
+  // 11 kg mixed and split into full packages, the remainder last
+  ASSERT_EQ(3, pkgs.size());
+  EXPECT_DOUBLE_EQ(4, pkgs[0]->quantity());
+  EXPECT_DOUBLE_EQ(4, pkgs[1]->quantity());
+  EXPECT_DOUBLE_EQ(3, pkgs[2]->quantity());
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, PackageGroupsWholeBatches) {
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+  ClockedConditioning* fac =
+      NewConditioning(0, std::vector<std::string>(1, "out"));
+  fac->package_capacity = 10;
+  fac->package_fill = false;
+
+  double qtys[] = {4, 5, 3, 7, 12};
+  std::vector<cyclus::Material::Ptr> mats;
+  for (int i = 0; i < 5; ++i) {
+    mats.push_back(cyclus::Material::CreateUntracked(qtys[i], c));
+  }
+  std::vector<cyclus::Material::Ptr> pkgs = Package(fac, mats);
+
+  // consecutive batches grouped while they fit, and a batch larger than a
+  // package kept whole in a package of its own
+  ASSERT_EQ(3, pkgs.size());
+  EXPECT_DOUBLE_EQ(9, pkgs[0]->quantity());
+  EXPECT_DOUBLE_EQ(10, pkgs[1]->quantity());
+  EXPECT_DOUBLE_EQ(12, pkgs[2]->quantity());
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, DiscreteHandlingReleasesFilledPackages) {
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+  ClockedConditioning* fac =
+      NewConditioning(0, std::vector<std::string>(1, "out"));
+  fac->package_capacity = 4;
+  fac->package_fill = true;
+  fac->EnterNotify();
+
+  Receive(fac, cyclus::Material::CreateUntracked(3, c));
+  Receive(fac, cyclus::Material::CreateUntracked(3, c));
+  Receive(fac, cyclus::Material::CreateUntracked(5, c));
+  fac->Tock();
+
+  // the batches are combined and split into packages, which are then
+  // released whole
+  std::vector<cyclus::Material::Ptr> stocks = Stocks(fac);
+  ASSERT_EQ(3, stocks.size());
+  EXPECT_DOUBLE_EQ(4, stocks[0]->quantity());
+  EXPECT_DOUBLE_EQ(4, stocks[1]->quantity());
+  EXPECT_DOUBLE_EQ(3, stocks[2]->quantity());
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, PopBlendMatchesPop) {
+  using cyclus::Material;
+
+  int other_nucs[] = {551370000, 380900000, 942390000};
+  std::vector<cyclus::Composition::Ptr> comps;
+  for (int i = 0; i < 3; ++i) {
+    cyclus::CompMap v;
+    v[922350000] = 1 + i;
+    v[922380000] = 90;
+    v[other_nucs[i]] = 5 * i + 1;
+    comps.push_back(cyclus::Composition::CreateFromMass(v));
+  }
+
+  // the same batches in two buffers, several sharing a composition
+  cyclus::toolkit::ResBuf<Material> by_map;
+  cyclus::toolkit::ResBuf<Material> dense;
+  for (int i = 0; i < 20; ++i) {
+    double qty = 3 + i % 7;
+    by_map.Push(Material::CreateUntracked(qty, comps[i % 3]));
+    dense.Push(Material::CreateUntracked(qty, comps[i % 3]));
+  }
+
+  double qty = 0.6 * by_map.quantity();
+  Material::Ptr expected = by_map.Pop(qty, cyclus::eps_rsrc());
+  Material::Ptr blended = PopBlend(dense, qty);
+
+  EXPECT_NEAR(expected->quantity(), blended->quantity(), cyclus::eps_rsrc());
+  EXPECT_NEAR(by_map.quantity(), dense.quantity(), cyclus::eps_rsrc());
+
+  cyclus::CompMap want = expected->comp()->mass();
+  cyclus::CompMap got = blended->comp()->mass();
+  cyclus::compmath::Normalize(&want, expected->quantity());
+  cyclus::compmath::Normalize(&got, blended->quantity());
+  ASSERT_EQ(want.size(), got.size());
+  cyclus::CompMap::iterator it;
+  for (it = want.begin(); it != want.end(); ++it) {
+    EXPECT_NEAR(it->second, got[it->first], cyclus::eps_rsrc())
+        << "nuclide " << it->first;
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, ParallelTockMatchesSerial) {
+  // build with -DCYDER_TSAN=ON to run this under ThreadSanitizer, as CI does
+  const int n_facs = 64;
+  const int n_threads = 8;
+
+  cyclus::CompMap v;
+  v[922350000] = 5;
+  v[922380000] = 95;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+
+  // two identical fleets with different arrivals, throughputs and options
+  // per agent, covering every option the class documentation calls safe.
+  // Continuous agents get more throughput than they receive, and all
+  // material shares one composition, so nothing is split and merges need
+  // no new composition.
+  const char* orders[] = {"fifo", "priority", "largest", "smallest"};
+  std::vector<Conditioning*> fleets[2];
+  for (int k = 0; k < 2; ++k) {
+    for (int i = 0; i < n_facs; ++i) {
+      ClockedConditioning* fac =
+          NewConditioning(0, std::vector<std::string>(1, "out"));
+      fac->discrete_handling = i % 2 == 0;
+      fac->throughput = (fac->discrete_handling ? 5 : 55) + 7 * (i % 11);
+      fac->dense_blend = i % 4 == 1;
+      fac->release_order = orders[i / 2 % 4];
+      fac->discrete_fill = i % 3 == 0;
+      fac->consolidate = i % 5 == 2;
+      fac->cache_requests = i % 7 == 3;
+      fac->trace_counters = true;
+      fac->record_stats = true;
+      fac->record_inventory = true;
+      fac->shadow = true;
+      fac->EnterNotify();
+      fac->defer_output(true);
+      for (int j = 0; j < 1 + i % 13; ++j) {
+        Receive(fac, cyclus::Material::CreateUntracked(1 + j % 4, c));
+      }
+      fleets[k].push_back(fac);
+    }
+  }
+
+  std::vector<Conditioning*>& serial = fleets[0];
+  for (int i = 0; i < n_facs; ++i) {
+    serial[i]->Tock();
+  }
+
+  std::vector<Conditioning*>& parallel = fleets[1];
+  std::vector<std::thread> threads;
+  for (int t = 0; t < n_threads; ++t) {
+    threads.push_back(std::thread([&parallel, t, n_facs, n_threads]() {
+      for (int i = t; i < n_facs; i += n_threads) {
+        parallel[i]->Tock();
+      }
+    }));
+  }
+  for (int t = 0; t < n_threads; ++t) {
+    threads[t].join();
+  }
+
+  for (int i = 0; i < n_facs; ++i) {
+    EXPECT_EQ(Digest(serial[i]), Digest(parallel[i])) << "agent " << i;
+  }
+
+  // flushing in agent order is what a concurrent driver does after a phase
+  for (int i = 0; i < n_facs; ++i) {
+    serial[i]->FlushOutput();
+    parallel[i]->FlushOutput();
+    EXPECT_EQ(Digest(serial[i]), Digest(parallel[i])) << "agent " << i;
+  }
+}
+
+// Property tests: random arrival streams, residence times and throughputs
+// are run through a single-line facility one timestep at a time and checked
+// against a reference model of the documented behaviour. Batch masses are
+// whole kilograms so the reference needs no tolerance for release decisions.
+
+namespace {
+
+const int kCases = 300;
+
+struct Scenario {
+  int residence_time;
+  double throughput;
+  bool discrete_fill;
+  int duration;
+  // arrival masses (kg) per timestep
+  std::vector<std::vector<int> > arrivals;
+};
+
+Scenario RandomScenario(std::mt19937& gen) {
+  std::uniform_int_distribution<int> residence(0, 6);
+  std::uniform_int_distribution<int> throughput(0, 30);
+  std::uniform_int_distribution<int> coin(0, 1);
+  std::uniform_int_distribution<int> duration(10, 40);
+  std::uniform_int_distribution<int> count(0, 4);
+  std::uniform_int_distribution<int> mass(1, 9);
+
+  Scenario sc;
+  sc.residence_time = residence(gen);
+  int cap = throughput(gen);
+  sc.throughput = cap == 0 ? 1e299 : cap;
+  sc.discrete_fill = coin(gen) == 1;
+  sc.duration = duration(gen);
+  for (int t = 0; t < sc.duration; ++t) {
+    // leave gaps in the stream so idle timesteps are covered too
+    int n = coin(gen) == 1 ? count(gen) : 0;
+    std::vector<int> masses;
+    for (int i = 0; i < n; ++i) {
+      masses.push_back(mass(gen));
+    }
+    sc.arrivals.push_back(masses);
+  }
+  return sc;
+}
+
+std::string Describe(const Scenario& sc) {
+  std::stringstream ss;
+  ss << "residence_time=" << sc.residence_time
+     << " throughput=" << sc.throughput
+     << " discrete_fill=" << sc.discrete_fill << " duration=" << sc.duration;
+  return ss.str();
+}
+
+}  // namespace
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, DiscretePropertiesHoldForRandomStreams) {
+  std::mt19937 gen(20170601);
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+
+  for (int k = 0; k < kCases; ++k) {
+    Scenario sc = RandomScenario(gen);
+    ClockedConditioning* fac = NewConditioning(
+        sc.residence_time, std::vector<std::string>(1, "out"));
+    fac->throughput = sc.throughput;
+    fac->discrete_fill = sc.discrete_fill;
+    fac->EnterNotify();
+
+    // reference model: batches wait in arrival order, become ready
+    // residence_time after arriving and are released in ready order
+    std::map<cyclus::Material*, int> entered;
+    std::deque<cyclus::Material::Ptr> waiting;
+    std::deque<cyclus::Material::Ptr> ready;
+    std::vector<cyclus::Material::Ptr> released;
+    double received = 0;
+
+    for (int t = 0; t < sc.duration; ++t) {
+      for (int i = 0; i < sc.arrivals[t].size(); ++i) {
+        cyclus::Material::Ptr m =
+            cyclus::Material::CreateUntracked(sc.arrivals[t][i], c);
+        Receive(fac, m);
+        entered[m.get()] = t;
+        waiting.push_back(m);
+        received += m->quantity();
+      }
+      fac->time = t;
+      fac->Tock();
+
+      while (!waiting.empty() &&
+             entered[waiting.front().get()] + sc.residence_time <= t) {
+        ready.push_back(waiting.front());
+        waiting.pop_front();
+      }
+      double ready_qty = 0;
+      for (int i = 0; i < ready.size(); ++i) {
+        ready_qty += ready[i]->quantity();
+      }
+      double remaining = sc.throughput;
+      std::deque<cyclus::Material::Ptr> held;
+      for (int i = 0; i < ready.size(); ++i) {
+        double qty = ready[i]->quantity();
+        if (ready_qty <= sc.throughput || qty <= remaining) {
+          released.push_back(ready[i]);
+          remaining -= qty;
+        } else if (sc.discrete_fill) {
+          held.push_back(ready[i]);
+        } else {
+          held.insert(held.end(), ready.begin() + i, ready.end());
+          break;
+        }
+      }
+      ready.swap(held);
+
+      std::string where = Describe(sc) + " at t=" + std::to_string(t);
+      ASSERT_NEAR(received, Held(fac), cyclus::eps_rsrc()) << where;
+
+      std::vector<cyclus::Material::Ptr> stocks = Stocks(fac);
+      ASSERT_EQ(released.size(), stocks.size()) << where;
+      for (int i = 0; i < stocks.size(); ++i) {
+        // batches are never split or merged, and leave in reference order
+        ASSERT_EQ(released[i].get(), stocks[i].get()) << where;
+        ASSERT_LE(entered[stocks[i].get()] + sc.residence_time, t) << where;
+      }
+    }
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, ContinuousPropertiesHoldForRandomStreams) {
+  std::mt19937 gen(19700101);
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+
+  for (int k = 0; k < kCases; ++k) {
+    Scenario sc = RandomScenario(gen);
+    ClockedConditioning* fac = NewConditioning(
+        sc.residence_time, std::vector<std::string>(1, "out"));
+    fac->throughput = sc.throughput;
+    fac->discrete_handling = false;
+    fac->dense_blend = k % 2 == 1;
+    fac->EnterNotify();
+
+    // reference model: mass becomes ready residence_time after arriving and
+    // up to throughput of the ready mass is released each timestep
+    std::vector<double> arrived(sc.duration, 0);
+    double received = 0;
+    double ready = 0;
+    double released = 0;
+
+    for (int t = 0; t < sc.duration; ++t) {
+      for (int i = 0; i < sc.arrivals[t].size(); ++i) {
+        Receive(fac, cyclus::Material::CreateUntracked(sc.arrivals[t][i], c));
+        arrived[t] += sc.arrivals[t][i];
+        received += sc.arrivals[t][i];
+      }
+      fac->time = t;
+      fac->Tock();
+
+      if (t - sc.residence_time >= 0) {
+        ready += arrived[t - sc.residence_time];
+      }
+      double moved = std::min(ready, sc.throughput);
+      ready -= moved;
+      released += moved;
+
+      std::string where = Describe(sc) + " at t=" + std::to_string(t);
+      ASSERT_NEAR(received, Held(fac), cyclus::eps_rsrc()) << where;
+
+      std::vector<cyclus::Material::Ptr> stocks = Stocks(fac);
+      double stocked = 0;
+      for (int i = 0; i < stocks.size(); ++i) {
+        stocked += stocks[i]->quantity();
+      }
+      ASSERT_NEAR(released, stocked, 1e-6) << where;
+    }
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, LoweredInventoryLimitKeepsWhatIsHeld) {
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+
+  ClockedConditioning* fac =
+      NewConditioning(0, std::vector<std::string>(1, "out"));
+  fac->max_inv_size = 20;
+  fac->max_inv_size_schedule[0] = 4;
+  fac->processing_throughput = 2;
+  fac->EnterNotify();
+  for (int i = 0; i < 5; ++i) {
+    Receive(fac, cyclus::Material::CreateUntracked(2, c));
+  }
+
+  // a full inventory, above the scheduled limit
+  ASSERT_NO_THROW(fac->Tick());
+  EXPECT_DOUBLE_EQ(10, InventoryCapacity(fac));
+  fac->Tock();
+
+  // one batch was processed and stocked, leaving no room below the limit
+  fac->time = 1;
+  ASSERT_NO_THROW(fac->Tick());
+  EXPECT_DOUBLE_EQ(8, InventoryCapacity(fac));
+  EXPECT_DOUBLE_EQ(10, Held(fac));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, CohortsDecayOnceWithSharedCompositions) {
+  int residence_time = 6;
+  ClockedConditioning* fac =
+      NewConditioning(residence_time, std::vector<std::string>(1, "out"));
+  fac->decay_on_ready = true;
+  fac->EnterNotify();
+
+  cyclus::CompMap v;
+  v[551370000] = 1;
+  v[922380000] = 1;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+  for (int i = 0; i < 3; ++i) {
+    Receive(fac, cyclus::Material::CreateUntracked(10, c));
+  }
+  for (int t = 0; t <= residence_time; ++t) {
+    fac->time = t;
+    fac->Tock();
+  }
+
+  std::vector<cyclus::Material::Ptr> stocks = Stocks(fac);
+  ASSERT_EQ(3, stocks.size());
+  cyclus::Composition::Ptr decayed = stocks[0]->comp();
+  EXPECT_NE(c, decayed);
+  EXPECT_EQ(c->Decay(residence_time, tc_.get()->dt())->mass(), decayed->mass());
+  for (int i = 1; i < stocks.size(); ++i) {
+    EXPECT_EQ(decayed, stocks[i]->comp());
+  }
+  EXPECT_NEAR(30, Held(fac), cyclus::eps_rsrc());
+
+  // the materials' decay time advanced, so decaying again to the same time
+  // does not decay them twice
+  for (int i = 0; i < stocks.size(); ++i) {
+    stocks[i]->Decay(residence_time);
+    EXPECT_EQ(decayed, stocks[i]->comp());
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, ReleaseOrdersPickByRank) {
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+  double qtys[] = {3, 8, 5, 2};
+
+  std::map<std::string, std::vector<double> > want;
+  want["fifo"] = std::vector<double>(qtys, qtys + 1);
+  double largest[] = {8, 2};
+  want["largest"] = std::vector<double>(largest, largest + 2);
+  double smallest[] = {2, 3, 5};
+  want["smallest"] = std::vector<double>(smallest, smallest + 3);
+  // hot batches first, then waste in arrival order
+  double priority[] = {8, 2};
+  want["priority"] = std::vector<double>(priority, priority + 2);
+
+  std::map<std::string, std::vector<double> >::iterator it;
+  for (it = want.begin(); it != want.end(); ++it) {
+    ClockedConditioning* fac =
+        NewConditioning(0, std::vector<std::string>(1, "out"));
+    fac->in_commods.push_back("hot");
+    fac->in_commod_prefs.push_back(1);
+    fac->in_commod_prefs.push_back(5);
+    fac->throughput = 10;
+    fac->release_order = it->first;
+    fac->EnterNotify();
+    for (int i = 0; i < 4; ++i) {
+      Receive(fac, cyclus::Material::CreateUntracked(qtys[i], c),
+              i % 2 == 1 ? "hot" : "waste");
+    }
+    fac->Tock();
+
+    std::vector<cyclus::Material::Ptr> stocks = Stocks(fac);
+    std::vector<double> got;
+    for (int i = 0; i < stocks.size(); ++i) {
+      got.push_back(stocks[i]->quantity());
+    }
+    EXPECT_EQ(it->second, got) << it->first;
+    EXPECT_DOUBLE_EQ(18, Held(fac)) << it->first;
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, BulkReceiveMergesStreams) {
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+  cyclus::CompMap w;
+  w[922380000] = 1;
+  cyclus::Composition::Ptr d = cyclus::Composition::CreateFromMass(w);
+
+  for (int discrete = 0; discrete < 2; ++discrete) {
+    ClockedConditioning* fac =
+        NewConditioning(0, std::vector<std::string>(1, "out"));
+    fac->in_commods.push_back("hot");
+    fac->bulk_receive = true;
+    fac->discrete_handling = discrete == 1;
+    fac->EnterNotify();
+
+    std::vector<cyclus::Material::Ptr> mats;
+    std::vector<std::string> in_commods;
+    for (int i = 0; i < 12; ++i) {
+      mats.push_back(cyclus::Material::CreateUntracked(1 + i, i % 3 ? c : d));
+      in_commods.push_back(i % 2 ? "hot" : "waste");
+    }
+    Accept(fac, mats, in_commods);
+
+    // two commodities times two compositions when merging
+    int want = discrete ? mats.size() : 4;
+    EXPECT_EQ(want, InventoryCount(fac));
+    EXPECT_EQ(want, Received(fac).size());
+    EXPECT_DOUBLE_EQ(78, Held(fac));
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, ConsolidationShrinksHeldMemory) {
+  cyclus::CompMap v;
+  v[922350000] = 5;
+  v[922380000] = 95;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+
+  std::map<std::string, size_t> reports[2];
+  for (int k = 0; k < 2; ++k) {
+    ClockedConditioning* fac =
+        NewConditioning(5, std::vector<std::string>(1, "out"));
+    fac->consolidate = k == 1;
+    fac->EnterNotify();
+    for (int t = 0; t < 3; ++t) {
+      for (int i = 0; i < 20; ++i) {
+        Receive(fac, cyclus::Material::CreateUntracked(1, c));
+      }
+      fac->time = t;
+      fac->Tock();
+    }
+    EXPECT_DOUBLE_EQ(60, Held(fac));
+    std::vector<CohortRun> runs = Runs(fac, 2);
+    ASSERT_EQ(3, runs.size());
+    for (int i = 0; i < runs.size(); ++i) {
+      EXPECT_EQ(k == 1 ? 1 : 20, runs[i].count);
+    }
+    reports[k] = fac->MemoryReport();
+  }
+
+  EXPECT_EQ(0, reports[1]["inventory"]);
+  EXPECT_LT(10 * reports[1]["packaged"], reports[0]["packaged"]);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, ShadowAgreesOnRandomStreams) {
+  std::mt19937 gen(20240229);
+  const char* orders[] = {"fifo", "priority", "largest", "smallest"};
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  cyclus::CompMap w;
+  w[922380000] = 1;
+  cyclus::Composition::Ptr comps[] = {
+      cyclus::Composition::CreateFromMass(v),
+      cyclus::Composition::CreateFromMass(w)};
+
+  for (int k = 0; k < kCases / 3; ++k) {
+    Scenario sc = RandomScenario(gen);
+    ClockedConditioning* fac = NewConditioning(
+        sc.residence_time, std::vector<std::string>(1, "out"));
+    fac->in_commods.push_back("hot");
+    fac->in_commod_prefs.push_back(1);
+    fac->in_commod_prefs.push_back(2);
+    fac->throughput = sc.throughput;
+    fac->discrete_handling = k % 5 != 0;
+    fac->discrete_fill = sc.discrete_fill;
+    fac->release_order = orders[k % 4];
+    fac->package_capacity = k % 3 == 0 ? 7 : 0;
+    fac->package_fill = k % 2 == 1;
+    fac->consolidate = k % 4 == 1;
+    fac->processing_throughput = k % 7 == 0 ? 15 : 1e299;
+    fac->packaging_throughput = k % 7 == 3 ? 15 : 1e299;
+    fac->shadow = true;
+    fac->EnterNotify();
+
+    for (int t = 0; t < sc.duration; ++t) {
+      for (int i = 0; i < sc.arrivals[t].size(); ++i) {
+        Receive(fac,
+                cyclus::Material::CreateUntracked(sc.arrivals[t][i],
+                                                  comps[i % 2]),
+                i % 3 == 0 ? "hot" : "waste");
+      }
+      fac->time = t;
+      fac->Tock();
+      ASSERT_FALSE(Diverged(fac)) << "case " << k << " " << Describe(sc)
+                                  << " at t=" << t;
+    }
+  }
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, ShadowReportsFirstDivergence) {
+  cyclus::CompMap v;
+  v[922350000] = 1;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+
+  ClockedConditioning* fac =
+      NewConditioning(0, std::vector<std::string>(1, "out"));
+  fac->throughput = 5;
+  fac->shadow = true;
+  fac->EnterNotify();
+  fac->defer_output(true);
+  for (int i = 0; i < 3; ++i) {
+    Receive(fac, cyclus::Material::CreateUntracked(4, c));
+  }
+  fac->Tock();
+  EXPECT_FALSE(Diverged(fac));
+
+  // a stale ready_qtys mirror makes the fast path release two batches
+  ReadyQtys(fac, 0)[0] = 1;
+  fac->time = 1;
+  fac->Tock();
+  EXPECT_TRUE(Diverged(fac));
+
+  std::string digest = Digest(fac);
+  EXPECT_NE(std::string::npos, digest.find("ConditioningShadow"));
+  EXPECT_EQ(digest.find("ConditioningShadow"),
+            digest.rfind("ConditioningShadow"));
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(ConditioningTest, NuclideCountsShareOneSchema) {
+  // a backend fixes each table's columns from its first row, so agents
+  // recording different numbers of nuclides must write the same columns
+  const char* path = "cyder_nuclide_schema_test.sqlite";
+  std::remove(path);
+  {
+    cyclus::SqliteBack back(path);
+    cyclus::Recorder rec;
+    rec.RegisterBackend(&back);
+    cyclus::Timer ti;
+    cyclus::Context ctx(&ti, &rec);
+
+    cyclus::CompMap v;
+    v[922350000] = 5;
+    v[922380000] = 90;
+    v[942390000] = 5;
+    cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+
+    int widths[] = {0, 1, 3};
+    std::vector<ClockedConditioning*> facs;
+    for (int i = 0; i < 3; ++i) {
+      ClockedConditioning* fac = new ClockedConditioning(&ctx);
+      fac->in_commods.push_back("waste");
+      fac->out_commods.push_back("out");
+      fac->record_inventory = true;
+      fac->inventory_nuclides = widths[i];
+      fac->EnterNotify();
+      Receive(fac, cyclus::Material::CreateUntracked(10, c));
+      fac->Tock();
+      facs.push_back(fac);
+    }
+    rec.Flush();
+
+    EXPECT_EQ(3, back.Query("ConditioningInventory", NULL).rows.size());
+    cyclus::QueryResult qr = back.Query("ConditioningNuclides", NULL);
+    ASSERT_EQ(4, qr.rows.size());
+    for (int i = 0; i < qr.rows.size(); ++i) {
+      if (qr.GetVal<int>("Rank", i) == 1) {
+        EXPECT_EQ(922380000, qr.GetVal<int>("Nuc", i));
+        EXPECT_DOUBLE_EQ(9, qr.GetVal<double>("Qty", i));
+      }
+    }
+
+    for (int i = 0; i < facs.size(); ++i) {
+      delete facs[i];
+    }
+    rec.Close();
+  }
+  std::remove(path);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST(StepScheduleTest, HoldsEachValueUntilTheNextChange) {
+  std::map<int, double> changes;
+  changes[3] = 10;
+  changes[5] = 0;
+  changes[8] = 20;
+
+  StepSchedule sched;
+  sched.Init(1, changes);
+  double expected[] = {1, 1, 1, 10, 10, 0, 0, 0, 20, 20};
+  for (int t = 0; t < 10; ++t) {
+    EXPECT_EQ(expected[t], sched(t)) << "at t=" << t;
+  }
+  EXPECT_EQ(20, sched(12));
+
+  // looking back rewinds the cursor
+  EXPECT_EQ(1, sched(2));
+  EXPECT_EQ(0, sched(6));
+  EXPECT_EQ(0, sched(6));
+
+  sched.Init(7, std::map<int, double>());
+  EXPECT_EQ(7, sched(0));
+  EXPECT_EQ(7, sched(100));
+}
+
+}  // namespace conditioning
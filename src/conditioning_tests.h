@@ -0,0 +1,165 @@
+#ifndef CYDER_SRC_CONDITIONING_TESTS_H_
+#define CYDER_SRC_CONDITIONING_TESTS_H_
+
+#include <gtest/gtest.h>
+
+#include <deque>
+#include <list>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "conditioning.h"
+#include "test_context.h"
+
+namespace conditioning {
+
+/// A Conditioning whose clock and settings are set by the test
+class ClockedConditioning : public Conditioning {
+ public:
+  explicit ClockedConditioning(cyclus::Context* ctx)
+      : Conditioning(ctx), time(0) {}
+
+  int time;
+
+  using Conditioning::in_commods;
+  using Conditioning::in_commod_prefs;
+  using Conditioning::in_commod_outs;
+  using Conditioning::out_commods;
+  using Conditioning::residence_time;
+  using Conditioning::throughput;
+  using Conditioning::throughput_schedule;
+  using Conditioning::max_inv_size;
+  using Conditioning::max_inv_size_schedule;
+  using Conditioning::processing_throughput;
+  using Conditioning::packaging_throughput;
+  using Conditioning::discrete_handling;
+  using Conditioning::discrete_fill;
+  using Conditioning::package_capacity;
+  using Conditioning::package_fill;
+  using Conditioning::dense_blend;
+  using Conditioning::decay_on_ready;
+  using Conditioning::release_order;
+  using Conditioning::cache_requests;
+  using Conditioning::bulk_receive;
+  using Conditioning::consolidate;
+  using Conditioning::shadow;
+  using Conditioning::trace_counters;
+  using Conditioning::record_stats;
+  using Conditioning::record_inventory;
+  using Conditioning::inventory_nuclides;
+
+ protected:
+  virtual int now() const { return time; }
+};
+
+/// Drives Conditioning stages directly, outside of a simulation. The
+/// TestContext clock never advances, so times are passed explicitly or set
+/// on a ClockedConditioning.
+class ConditioningTest : public ::testing::Test {
+ protected:
+  typedef Conditioning::CohortRun CohortRun;
+
+  virtual void TearDown();
+
+  /// @brief a discrete single- or multi-line facility, owned by the fixture
+  ClockedConditioning* NewConditioning(
+      int residence_time, const std::vector<std::string>& out_commods);
+
+  /// @brief packs n packages of 10 kg into line l's residence at a time
+  void Enter(Conditioning* fac, int l, int time, int n);
+
+  /// @brief moves line l's cohort that entered at a time to ready
+  void Ready(Conditioning* fac, int l, int time) { fac->ReadyMatl_(l, time); }
+
+  int ReadyCount(Conditioning* fac, int l) {
+    return fac->lines[l].ready_count();
+  }
+
+  const std::vector<int>& Cohorts(Conditioning* fac) { return fac->cohorts; }
+
+  std::vector<CohortRun> Runs(Conditioning* fac, int now) {
+    return fac->CohortRuns_(now);
+  }
+
+  void Restore(Conditioning* fac, const std::vector<CohortRun>& runs) {
+    fac->RestoreCohorts_(runs);
+  }
+
+  std::vector<CohortRun> EntryTimeRuns(const std::list<int>& entry_times) {
+    return Conditioning::EntryTimeRuns_(entry_times);
+  }
+
+  std::vector<cyclus::Material::Ptr> Package(
+      Conditioning* fac, const std::vector<cyclus::Material::Ptr>& mats) {
+    return fac->Package_(mats);
+  }
+
+  cyclus::Material::Ptr PopBlend(
+      cyclus::toolkit::ResBuf<cyclus::Material>& buf, double qty) {
+    return Conditioning::PopBlend_(buf, qty);
+  }
+
+  void Receive(Conditioning* fac, cyclus::Material::Ptr mat) {
+    fac->AddMat_(mat);
+  }
+
+  /// @brief receives mat as if it was traded for in_commod
+  void Receive(Conditioning* fac, cyclus::Material::Ptr mat,
+               const std::string& in_commod) {
+    fac->inventory.Push(mat);
+    fac->buy_policy.received().push_back(in_commod);
+  }
+
+  /// @brief accepts a trade of mat under in_commod for each element
+  void Accept(Conditioning* fac, const std::vector<cyclus::Material::Ptr>& mats,
+              const std::vector<std::string>& in_commods);
+
+  int InventoryCount(Conditioning* fac) { return fac->inventory.count(); }
+
+  std::set<cyclus::RequestPortfolio<cyclus::Material>::Ptr> Requests(
+      Conditioning* fac) {
+    return fac->buy_policy.GetMatlRequests();
+  }
+
+  double InventoryCapacity(Conditioning* fac) {
+    return fac->inventory.capacity();
+  }
+
+  const std::vector<std::string>& Received(Conditioning* fac) {
+    return fac->buy_policy.received();
+  }
+
+  /// @brief whether fac has recorded a divergence from its shadow model
+  bool Diverged(Conditioning* fac) { return fac->shadow_diverged; }
+
+  std::deque<double>& ReadyQtys(Conditioning* fac, int l) {
+    return fac->lines[l].ready_qtys;
+  }
+
+  /// @brief a line's stocks, in buffer order
+  std::vector<cyclus::Material::Ptr> Stocks(Conditioning* fac, int l = 0);
+
+  /// @brief the mass held in all of fac's buffers
+  double Held(Conditioning* fac);
+
+  /// @brief describes fac's stage holdings and its unflushed rows, without
+  /// agent ids, so agents driven the same way give the same description
+  std::string Digest(Conditioning* fac);
+
+  /// @brief copies src's buffers into dst through SnapshotInv and InitInv
+  void CopyInv(Conditioning* src, Conditioning* dst);
+
+  /// @brief copies the input commodities of src's inventory into dst, as
+  /// Snapshot and InitFrom do
+  void CopyReceived(Conditioning* src, Conditioning* dst) {
+    dst->RestoreReceived_(src->ReceivedRuns_());
+  }
+
+  cyclus::TestContext tc_;
+  std::vector<Conditioning*> facs_;
+};
+
+}  // namespace conditioning
+
+#endif  // CYDER_SRC_CONDITIONING_TESTS_H_
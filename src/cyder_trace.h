@@ -0,0 +1,40 @@
+#ifndef CYDER_SRC_CYDER_TRACE_H_
+#define CYDER_SRC_CYDER_TRACE_H_
+
+/// @file cyder_trace.h
+/// Compile-time tracing for the cyder archetypes.
+///
+/// CYDER_TRACE_LEVEL is set on the cyder target by the CMake cache variable
+/// of the same name. Trace statements above that level are never executed,
+/// and at level 0 (the default, and always the case in release builds) the
+/// statements and their arguments are removed by the preprocessor.
+///
+/// Each trace statement adds one line of the form
+///   [cyder] <prototype>:<id> t=<time> <event> n=<count>
+/// to the OutputBuffer output_ of the enclosing agent, like CYDER_LOG, so
+/// tracing is safe in agents run concurrently. The lines are written to
+/// std::clog, without flushing it, when the buffer is flushed.
+
+#ifndef CYDER_TRACE_LEVEL
+#define CYDER_TRACE_LEVEL 0
+#endif
+
+/// one line per stage transfer (whole cohorts)
+#define CYDER_TRACE_STAGE 1
+/// one line per agent phase (Tick/Tock)
+#define CYDER_TRACE_PHASE 2
+
+#if CYDER_TRACE_LEVEL > 0
+#define CYDER_TRACE(level, agent, event, count)                           \
+  if ((level) > CYDER_TRACE_LEVEL) {                                      \
+  } else                                                                  \
+    output_.Trace() << "[cyder] " << (agent)->prototype() << ":"         \
+                    << (agent)->id() << " t=" << (agent)->context()->time() \
+                    << " " << (event) << " n=" << (count) << "\n"
+#else
+#define CYDER_TRACE(level, agent, event, count) \
+  do {                                          \
+  } while (0)
+#endif
+
+#endif  // CYDER_SRC_CYDER_TRACE_H_
@@ -0,0 +1,124 @@
+#ifndef CYDER_SRC_OUTPUT_BUFFER_H_
+#define CYDER_SRC_OUTPUT_BUFFER_H_
+
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cyclus.h"
+
+namespace conditioning {
+
+/// @class OutputBuffer
+///
+/// Holds the table rows, log lines and trace lines an agent produces during
+/// a phase so that the phase touches no simulation-wide state. Flush records
+/// the rows through the context and writes the log and trace lines, in the
+/// order they were added, from whichever thread the caller chooses.
+class OutputBuffer {
+ public:
+  /// @class Row
+  ///
+  /// A table row, filled like a cyclus::Datum. Field names are kept as
+  /// pointers until the row is recorded, as they are by cyclus::Datum.
+  class Row {
+   public:
+    explicit Row(const std::string& title) : title_(title) {}
+
+    Row* AddVal(const char* field, boost::spirit::hold_any val) {
+      vals_.push_back(std::make_pair(field, val));
+      return this;
+    }
+
+    /// @brief does nothing, the row is recorded on Flush. Kept so rows read
+    /// like datums.
+    void Record() {}
+
+    const std::string& title() const { return title_; }
+
+    const std::vector<std::pair<const char*, boost::spirit::hold_any> >&
+    vals() const {
+      return vals_;
+    }
+
+   private:
+    friend class OutputBuffer;
+    std::string title_;
+    std::vector<std::pair<const char*, boost::spirit::hold_any> > vals_;
+  };
+
+  /// @brief starts a row of a table
+  Row* NewDatum(const std::string& title) {
+    rows_.push_back(Row(title));
+    return &rows_.back();
+  }
+
+  /// @brief starts a log line, see CYDER_LOG
+  std::ostream& Log(cyclus::LogLevel level, const std::string& prefix) {
+    logs_.emplace_back();
+    logs_.back().level = level;
+    logs_.back().prefix = prefix;
+    return logs_.back().msg;
+  }
+
+  /// @brief starts a trace line, see CYDER_TRACE. Trace lines are written to
+  /// std::clog rather than the cyclus logger.
+  std::ostream& Trace() {
+    traces_.emplace_back();
+    return traces_.back();
+  }
+
+  /// @brief records the held rows through ctx and writes the held log and
+  /// trace lines, then empties the buffer
+  void Flush(cyclus::Context* ctx) {
+    for (int i = 0; i < rows_.size(); ++i) {
+      cyclus::Datum* d = ctx->NewDatum(rows_[i].title_);
+      for (int j = 0; j < rows_[i].vals_.size(); ++j) {
+        d->AddVal(rows_[i].vals_[j].first, rows_[i].vals_[j].second);
+      }
+      d->Record();
+    }
+    for (int i = 0; i < logs_.size(); ++i) {
+      cyclus::Logger().Get(logs_[i].level, logs_[i].prefix)
+          << logs_[i].msg.str();
+    }
+    for (int i = 0; i < traces_.size(); ++i) {
+      std::clog << traces_[i].str();
+    }
+    rows_.clear();
+    logs_.clear();
+    traces_.clear();
+  }
+
+  bool empty() const {
+    return rows_.empty() && logs_.empty() && traces_.empty();
+  }
+
+  /// @brief the rows held since the last flush, in the order they were added
+  const std::deque<Row>& rows() const { return rows_; }
+
+ private:
+  struct LogLine {
+    cyclus::LogLevel level;
+    std::string prefix;
+    std::ostringstream msg;
+  };
+
+  std::deque<Row> rows_;
+  std::deque<LogLine> logs_;
+  std::deque<std::ostringstream> traces_;
+};
+
+}  // namespace conditioning
+
+/// Like LOG, but writes into the OutputBuffer output_ of the enclosing
+/// agent. Lines above the report level are dropped without being formatted.
+#define CYDER_LOG(level, prefix)                      \
+  if ((level) > cyclus::Logger::ReportLevel()) {      \
+  } else                                              \
+    output_.Log(level, prefix)
+
+#endif  // CYDER_SRC_OUTPUT_BUFFER_H_
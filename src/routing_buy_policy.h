@@ -0,0 +1,140 @@
+#ifndef CYDER_SRC_ROUTING_BUY_POLICY_H_
+#define CYDER_SRC_ROUTING_BUY_POLICY_H_
+
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cyclus.h"
+
+namespace conditioning {
+
+/// @class RoutingBuyPolicy
+///
+/// A MatlBuyPolicy that remembers the commodity each received material was
+/// traded under. Materials are pushed into the policy's buffer in the order
+/// of received(), so the owning agent can route them by commodity when it
+/// empties the buffer.
+///
+/// With cache_requests set, the request portfolios built for a timestep are
+/// reused on following timesteps for as long as the requested amount is
+/// unchanged. Commodities, preferences and recipes are fixed once the policy
+/// is started, so the amount is the only input that can change the
+/// portfolios. No requests are made while the amount is below eps_rsrc().
+///
+/// With a bulk buffer set, the space the materials accepted in a timestep
+/// need is checked once, before any of them is pushed. Trades have already
+/// been made when they are accepted, so materials that do not fit cannot be
+/// refused: a ValueError is thrown, as a push into a full ResBuf would.
+/// When merging, materials traded under the same commodity with the same
+/// composition are first absorbed into one, and only the merged materials
+/// are handed on to MatlBuyPolicy::AcceptMatlTrades, so the buffer grows by
+/// one material per distinct stream rather than per trade. The base policy
+/// still pushes the materials it is handed one at a time, as it keeps a
+/// record per pushed material, so without merging the cost stays per
+/// trade.
+class RoutingBuyPolicy : public cyclus::toolkit::MatlBuyPolicy {
+ public:
+  RoutingBuyPolicy()
+      : cache_requests_(false), cached_qty_(-1), bulk_(NULL), merge_(false) {}
+
+  /// @brief turns reuse of unchanged request portfolios on or off
+  void cache_requests(bool cache) {
+    cache_requests_ = cache;
+    cached_ports_.clear();
+  }
+
+  /// @brief commodities of the materials pushed into the buffer, in push
+  /// order. The owning agent clears this when it empties the buffer.
+  std::vector<std::string>& received() { return received_; }
+
+  /// @brief turns the bulk receive path on or off
+  /// @param buf the buffer the policy was initialized with, or NULL to
+  /// receive trade by trade
+  /// @param merge whether to merge materials of the same commodity and
+  /// composition before pushing them
+  void bulk_receive(cyclus::toolkit::ResBuf<cyclus::Material>* buf,
+                    bool merge) {
+    bulk_ = buf;
+    merge_ = merge;
+  }
+
+  virtual void AcceptMatlTrades(
+      const std::vector<std::pair<cyclus::Trade<cyclus::Material>,
+                                  cyclus::Material::Ptr> >& resps) {
+    if (bulk_ == NULL) {
+      for (int i = 0; i < resps.size(); ++i) {
+        received_.push_back(resps[i].first.request->commodity());
+      }
+      cyclus::toolkit::MatlBuyPolicy::AcceptMatlTrades(resps);
+      return;
+    }
+
+    std::vector<std::pair<cyclus::Trade<cyclus::Material>,
+                          cyclus::Material::Ptr> > streams;
+    std::vector<std::string> commods;
+    // index in streams of each commodity and composition id
+    std::map<std::pair<std::string, int>, int> index;
+    double qty = 0;
+    for (int i = 0; i < resps.size(); ++i) {
+      const std::string& commod = resps[i].first.request->commodity();
+      cyclus::Material::Ptr mat = resps[i].second;
+      qty += mat->quantity();
+      if (merge_) {
+        std::pair<std::string, int> key(commod, mat->comp()->id());
+        std::map<std::pair<std::string, int>, int>::iterator it =
+            index.find(key);
+        if (it != index.end()) {
+          streams[it->second].second->Absorb(mat);
+          continue;
+        }
+        index[key] = streams.size();
+      }
+      streams.push_back(resps[i]);
+      commods.push_back(commod);
+    }
+    if (qty > bulk_->space() + cyclus::eps_rsrc()) {
+      std::stringstream ss;
+      ss << "accepted " << qty << " kg of material but only "
+         << bulk_->space() << " kg fit in the buffer";
+      throw cyclus::ValueError(ss.str());
+    }
+
+    // the base policy pushes each material and keeps its per-trade records
+    received_.insert(received_.end(), commods.begin(), commods.end());
+    cyclus::toolkit::MatlBuyPolicy::AcceptMatlTrades(streams);
+  }
+
+  virtual std::set<cyclus::RequestPortfolio<cyclus::Material>::Ptr>
+  GetMatlRequests() {
+    if (!cache_requests_) {
+      return cyclus::toolkit::MatlBuyPolicy::GetMatlRequests();
+    }
+
+    double qty = TotalQty();
+    if (qty < cyclus::eps_rsrc()) {
+      return std::set<cyclus::RequestPortfolio<cyclus::Material>::Ptr>();
+    } else if (cached_ports_.empty() || qty != cached_qty_) {
+      cached_ports_ = cyclus::toolkit::MatlBuyPolicy::GetMatlRequests();
+      cached_qty_ = qty;
+    }
+    return cached_ports_;
+  }
+
+ private:
+  std::vector<std::string> received_;
+
+  bool cache_requests_;
+  double cached_qty_;
+  std::set<cyclus::RequestPortfolio<cyclus::Material>::Ptr> cached_ports_;
+
+  cyclus::toolkit::ResBuf<cyclus::Material>* bulk_;
+  bool merge_;
+};
+
+}  // namespace conditioning
+
+#endif  // CYDER_SRC_ROUTING_BUY_POLICY_H_
@@ -0,0 +1,277 @@
+#ifndef CYDER_SRC_SHADOW_MODEL_H_
+#define CYDER_SRC_SHADOW_MODEL_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "cyclus.h"
+
+namespace conditioning {
+
+/// A batch of material as seen by ShadowModel
+struct ShadowBatch {
+  double qty;
+  /// composition id, -1 once batches of different compositions are mixed
+  int comp;
+  /// index of the line the batch is routed to
+  int line;
+  /// release rank, lower first. The negated preference until the batch
+  /// is ready, then its rank under the release order.
+  double rank;
+  /// time the batch entered residence
+  int entry;
+};
+
+/// @class ShadowModel
+///
+/// A reference implementation of a Conditioning Tock over batch quantities.
+/// It pops, packs and releases batch by batch, the way the archetype did
+/// before its fast paths were added, without incremental bookkeeping or
+/// indices, so its results can be compared with the archetype's buffers
+/// after every Tock. It is seeded from a copy of the archetype's state
+/// before each Tock, so a divergence is reported in the timestep it occurs.
+class ShadowModel {
+ public:
+  typedef std::deque<ShadowBatch> Stage;
+
+  struct Line {
+    Stage processing;
+    Stage packaged;
+    Stage ready;
+    Stage stocks;
+  };
+
+  /// @brief the archetype settings and the limits in effect for a Tock
+  struct Params {
+    int residence_time;
+    bool discrete;
+    bool fill;
+    std::string release_order;
+    double package_capacity;
+    bool package_fill;
+    bool consolidate;
+    double processing;
+    double packaging;
+    double throughput;
+  };
+
+  Stage inventory;
+  std::vector<Line> lines;
+
+  /// @brief moves batches through the stages as a Tock at time now would
+  void Tock(const Params& p, int now) {
+    Stage popped = PopUpTo(inventory, p.processing, !p.discrete);
+    std::vector<Stage> routed(lines.size());
+    for (std::size_t i = 0; i < popped.size(); ++i) {
+      routed[popped[i].line].push_back(popped[i]);
+    }
+    for (std::size_t l = 0; l < lines.size(); ++l) {
+      if (p.consolidate) {
+        routed[l] = Consolidate(routed[l]);
+      }
+      lines[l].processing.insert(lines[l].processing.end(), routed[l].begin(),
+                                 routed[l].end());
+    }
+
+    // the line served first from the shared capacities rotates with time
+    std::size_t first = lines.empty() ? 0 : now % lines.size();
+    double pack_cap = p.packaging;
+    for (std::size_t k = 0; k < lines.size(); ++k) {
+      Line& line = lines[(first + k) % lines.size()];
+      if (!line.processing.empty() && pack_cap > cyclus::eps_rsrc()) {
+        double before = Qty(line.processing);
+        Stage pkgs = Package(PopUpTo(line.processing, pack_cap, !p.discrete),
+                             p);
+        pack_cap -= before - Qty(line.processing);
+        for (std::size_t i = 0; i < pkgs.size(); ++i) {
+          pkgs[i].entry = now;
+          line.packaged.push_back(pkgs[i]);
+        }
+      }
+
+      while (!line.packaged.empty() &&
+             line.packaged.front().entry + p.residence_time <= now) {
+        ShadowBatch b = line.packaged.front();
+        line.packaged.pop_front();
+        if (p.release_order == "largest") {
+          b.rank = -b.qty;
+        } else if (p.release_order == "smallest") {
+          b.rank = b.qty;
+        }
+        line.ready.push_back(b);
+      }
+    }
+
+    double cap = p.throughput;
+    for (std::size_t k = 0; k < lines.size() && cap > cyclus::eps_rsrc();
+         ++k) {
+      Line& line = lines[(first + k) % lines.size()];
+      if (line.ready.empty()) {
+        continue;
+      }
+      double before = Qty(line.stocks);
+      if (p.discrete) {
+        Release(line, std::min(cap, Qty(line.ready)), p);
+      } else {
+        Stage moved = PopUpTo(line.ready, std::min(cap, Qty(line.ready)),
+                              true);
+        line.stocks.push_back(Mix(moved));
+      }
+      cap -= Qty(line.stocks) - before;
+    }
+  }
+
+  /// @brief a copy of a stage stably sorted by rank, the order a ranked
+  /// index holds the batches in
+  static Stage ByRank(const Stage& stage) {
+    Stage sorted = stage;
+    std::stable_sort(sorted.begin(), sorted.end(), RankLess);
+    return sorted;
+  }
+
+  static double Qty(const Stage& stage) {
+    double qty = 0;
+    for (std::size_t i = 0; i < stage.size(); ++i) {
+      qty += stage[i].qty;
+    }
+    return qty;
+  }
+
+ private:
+  static bool RankLess(const ShadowBatch& a, const ShadowBatch& b) {
+    return a.rank < b.rank;
+  }
+
+  /// @brief pops the leading batches that fit in cap, then splits the next
+  /// one if split is set
+  static Stage PopUpTo(Stage& stage, double cap, bool split) {
+    Stage popped;
+    double remaining = cap;
+    while (!stage.empty() &&
+           stage.front().qty <= remaining + cyclus::eps_rsrc()) {
+      remaining -= stage.front().qty;
+      popped.push_back(stage.front());
+      stage.pop_front();
+    }
+    if (split && remaining > cyclus::eps_rsrc() && !stage.empty()) {
+      ShadowBatch part = stage.front();
+      part.qty = remaining;
+      stage.front().qty -= remaining;
+      popped.push_back(part);
+    }
+    return popped;
+  }
+
+  static ShadowBatch Mix(const Stage& batches) {
+    ShadowBatch mixed = batches.front();
+    for (std::size_t i = 1; i < batches.size(); ++i) {
+      Absorb(mixed, batches[i]);
+    }
+    return mixed;
+  }
+
+  static void Absorb(ShadowBatch& into, const ShadowBatch& b) {
+    into.qty += b.qty;
+    into.comp = into.comp == b.comp ? into.comp : -1;
+    into.rank = std::min(into.rank, b.rank);
+  }
+
+  static Stage Consolidate(const Stage& batches) {
+    Stage merged;
+    for (std::size_t i = 0; i < batches.size(); ++i) {
+      std::size_t j = 0;
+      while (j < merged.size() && merged[j].comp != batches[i].comp) {
+        ++j;
+      }
+      if (j == merged.size()) {
+        merged.push_back(batches[i]);
+      } else {
+        Absorb(merged[j], batches[i]);
+      }
+    }
+    return merged;
+  }
+
+  static Stage Package(const Stage& batches, const Params& p) {
+    if (p.package_capacity <= 0 || batches.empty()) {
+      return batches;
+    }
+
+    Stage pkgs;
+    double cap = p.package_capacity;
+    if (p.package_fill) {
+      ShadowBatch mixed = Mix(batches);
+      while (mixed.qty > cap + cyclus::eps_rsrc()) {
+        ShadowBatch pkg = mixed;
+        pkg.qty = cap;
+        mixed.qty -= cap;
+        pkgs.push_back(pkg);
+      }
+      pkgs.push_back(mixed);
+    } else {
+      ShadowBatch pkg = batches.front();
+      for (std::size_t i = 1; i < batches.size(); ++i) {
+        if (pkg.qty + batches[i].qty <= cap + cyclus::eps_rsrc()) {
+          Absorb(pkg, batches[i]);
+        } else {
+          pkgs.push_back(pkg);
+          pkg = batches[i];
+        }
+      }
+      pkgs.push_back(pkg);
+    }
+    return pkgs;
+  }
+
+  /// @brief moves ready batches to stocks one at a time, in the release
+  /// order, until max_pop is used up
+  static void Release(Line& line, double max_pop, const Params& p) {
+    Stage& ready = line.ready;
+    std::vector<bool> taken(ready.size(), false);
+    double remaining = max_pop;
+    bool all = max_pop == Qty(ready);
+    bool skip = p.release_order == "priority" ? p.fill
+                : p.release_order == "fifo" ? p.fill
+                : p.release_order == "largest";
+
+    // visit order: by rank, ties in ready order
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < ready.size(); ++i) {
+      order.push_back(i);
+    }
+    if (p.release_order != "fifo") {
+      for (std::size_t i = 1; i < order.size(); ++i) {
+        for (std::size_t j = i;
+             j > 0 && ready[order[j]].rank < ready[order[j - 1]].rank; --j) {
+          std::swap(order[j], order[j - 1]);
+        }
+      }
+    }
+
+    for (std::size_t i = 0; i < order.size(); ++i) {
+      const ShadowBatch& b = ready[order[i]];
+      if (all || b.qty <= remaining) {
+        remaining -= b.qty;
+        taken[order[i]] = true;
+        line.stocks.push_back(b);
+      } else if (!skip) {
+        break;
+      }
+    }
+
+    Stage held;
+    for (std::size_t i = 0; i < ready.size(); ++i) {
+      if (!taken[i]) {
+        held.push_back(ready[i]);
+      }
+    }
+    ready.swap(held);
+  }
+};
+
+}  // namespace conditioning
+
+#endif  // CYDER_SRC_SHADOW_MODEL_H_
@@ -0,0 +1,51 @@
+#ifndef CYDER_SRC_STEP_SCHEDULE_H_
+#define CYDER_SRC_STEP_SCHEDULE_H_
+
+#include <cstddef>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace conditioning {
+
+/// @class StepSchedule
+///
+/// A piecewise constant value over simulation time. The value starts at a
+/// base and changes at each scheduled time, holding until the next change.
+/// Only the change points are stored. A cursor follows the last time looked
+/// up, so the lookups of an advancing clock are O(1) amortized; looking up
+/// an earlier time rewinds the cursor to the start.
+class StepSchedule {
+ public:
+  StepSchedule() : base_(0), cursor_(0) {}
+
+  /// @param base the value before the first scheduled change
+  /// @param changes the value taking effect at each time
+  void Init(double base, const std::map<int, double>& changes) {
+    base_ = base;
+    changes_.assign(changes.begin(), changes.end());
+    cursor_ = 0;
+  }
+
+  /// @brief the value at a time
+  inline double operator()(int time) const {
+    if (cursor_ > 0 && time < changes_[cursor_ - 1].first) {
+      cursor_ = 0;
+    }
+    while (cursor_ < changes_.size() && changes_[cursor_].first <= time) {
+      ++cursor_;
+    }
+    return cursor_ == 0 ? base_ : changes_[cursor_ - 1].second;
+  }
+
+ private:
+  double base_;
+  /// (time, value) of each change, in time order
+  std::vector<std::pair<int, double> > changes_;
+  /// the number of changes at or before the last time looked up
+  mutable std::size_t cursor_;
+};
+
+}  // namespace conditioning
+
+#endif  // CYDER_SRC_STEP_SCHEDULE_H_
@@ -0,0 +1,78 @@
+#ifndef CYDER_SRC_TIMED_POLICY_H_
+#define CYDER_SRC_TIMED_POLICY_H_
+
+#include <chrono>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "cyclus.h"
+
+namespace conditioning {
+
+/// @class TimedPolicy
+///
+/// Wraps a material trading policy (e.g. MatlBuyPolicy or MatlSellPolicy) and
+/// accumulates the wall-clock time spent in its resource exchange callbacks.
+/// The accumulated time is read and cleared by the owning agent with Lap().
+template <class Policy>
+class TimedPolicy : public Policy {
+ public:
+  TimedPolicy() : Policy(), elapsed_(0) {}
+
+  /// @brief returns the seconds spent in exchange callbacks since the last
+  /// call and resets the accumulator
+  double Lap() {
+    double t = elapsed_;
+    elapsed_ = 0;
+    return t;
+  }
+
+  virtual std::set<cyclus::RequestPortfolio<cyclus::Material>::Ptr>
+      GetMatlRequests() {
+    Clock::time_point start = Clock::now();
+    std::set<cyclus::RequestPortfolio<cyclus::Material>::Ptr> ports =
+        Policy::GetMatlRequests();
+    Add_(start);
+    return ports;
+  }
+
+  virtual void AcceptMatlTrades(
+      const std::vector<std::pair<cyclus::Trade<cyclus::Material>,
+                                  cyclus::Material::Ptr> >& resps) {
+    Clock::time_point start = Clock::now();
+    Policy::AcceptMatlTrades(resps);
+    Add_(start);
+  }
+
+  virtual std::set<cyclus::BidPortfolio<cyclus::Material>::Ptr> GetMatlBids(
+      cyclus::CommodMap<cyclus::Material>::type& commod_requests) {
+    Clock::time_point start = Clock::now();
+    std::set<cyclus::BidPortfolio<cyclus::Material>::Ptr> ports =
+        Policy::GetMatlBids(commod_requests);
+    Add_(start);
+    return ports;
+  }
+
+  virtual void GetMatlTrades(
+      const std::vector<cyclus::Trade<cyclus::Material> >& trades,
+      std::vector<std::pair<cyclus::Trade<cyclus::Material>,
+                            cyclus::Material::Ptr> >& responses) {
+    Clock::time_point start = Clock::now();
+    Policy::GetMatlTrades(trades, responses);
+    Add_(start);
+  }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  void Add_(Clock::time_point start) {
+    elapsed_ += std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  double elapsed_;
+};
+
+}  // namespace conditioning
+
+#endif  // CYDER_SRC_TIMED_POLICY_H_
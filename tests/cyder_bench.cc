@@ -0,0 +1,266 @@
+// cyder_bench.cc
+// Google Benchmark suite driving the Conditioning archetype under synthetic
+// load.
+//
+// The Tick, Tock and trade callback benchmarks call the archetype directly
+// through a cyclus::TestContext and need nothing else. The Simulation
+// benchmarks run full MockSim simulations, which load the archetype
+// dynamically: run them with CYCLUS_PATH pointing at the directory holding
+// libcyder, or filter them out with --benchmark_filter=-BM_Simulation.
+//
+// Benchmark arguments are, in order:
+//   materials       number of material batches received per timestep
+//   batch_size      mass of each batch (kg)
+//   residence_time  residence time (timesteps)
+//   throughput      throughput per timestep (kg), 0 for unlimited
+//   discrete        1 for discrete handling, 0 for continuous
+// and every benchmark reports ns/material.
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "conditioning.h"
+#include "logger.h"
+#include "mock_sim.h"
+#include "test_context.h"
+
+using cyclus::Bid;
+using cyclus::Composition;
+using cyclus::Material;
+using cyclus::Request;
+using cyclus::RequestPortfolio;
+using cyclus::Trade;
+
+namespace conditioning {
+
+/// Exposes the Conditioning members needed to drive the archetype outside
+/// of a simulation.
+class BenchConditioning : public Conditioning {
+ public:
+  BenchConditioning(cyclus::Context* ctx, const benchmark::State& state)
+      : Conditioning(ctx) {
+    in_commods.push_back("waste");
+    out_commods.push_back("packaged_waste");
+    residence_time = state.range(2);
+    if (state.range(3) > 0) {
+      throughput = state.range(3);
+    }
+    discrete_handling = state.range(4) != 0;
+  }
+
+  void Receive(const std::vector<Material::Ptr>& mats) {
+    for (int i = 0; i < mats.size(); ++i) {
+      AddMat_(mats[i]);
+    }
+  }
+
+  void Stock(const std::vector<Material::Ptr>& mats) {
+    lines[0].stocks.Push(mats);
+  }
+
+  /// @brief empties every buffer so each iteration starts from the same state
+  void Drain() {
+    inventory.PopN(inventory.count());
+    buy_policy.received().clear();
+    for (int l = 0; l < lines.size(); ++l) {
+      Line& line = lines[l];
+      line.processing.PopN(line.processing.count());
+      line.packaged.PopN(line.packaged.count());
+      line.ready.PopN(line.ready.count());
+      line.ready_qtys.clear();
+      line.ranked.clear();
+      line.ranked_qty = 0;
+      line.stocks.PopN(line.stocks.count());
+    }
+    cohorts.assign(cohorts.size(), 0);
+  }
+
+  cyclus::toolkit::MatlBuyPolicy& buyer() { return buy_policy; }
+  cyclus::toolkit::MatlSellPolicy& seller() { return lines[0].sell_policy; }
+};
+
+Composition::Ptr WasteComp() {
+  cyclus::CompMap v;
+  v[551370000] = 1;
+  v[922350000] = 1;
+  v[922380000] = 98;
+  return Composition::CreateFromMass(v);
+}
+
+std::vector<Material::Ptr> Batches(const benchmark::State& state) {
+  Composition::Ptr c = WasteComp();
+  std::vector<Material::Ptr> mats;
+  for (int i = 0; i < state.range(0); ++i) {
+    mats.push_back(Material::CreateUntracked(state.range(1), c));
+  }
+  return mats;
+}
+
+/// @brief reports the mean time per material batch handled
+void ReportPerMaterial(benchmark::State& state, int64_t per_iteration) {
+  state.SetItemsProcessed(state.iterations() * per_iteration);
+  state.counters["ns/material"] = benchmark::Counter(
+      1e-9 * state.iterations() * per_iteration,
+      benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+void BM_Tick(benchmark::State& state) {
+  cyclus::TestContext tc;
+  BenchConditioning* fac = new BenchConditioning(tc.get(), state);
+  fac->EnterNotify();
+  fac->Receive(Batches(state));
+
+  for (auto _ : state) {
+    fac->Tick();
+  }
+  ReportPerMaterial(state, state.range(0));
+  delete fac;
+}
+
+void BM_Tock(benchmark::State& state) {
+  // The TestContext clock stays at t=0, so with a nonzero residence_time this
+  // measures the intake stages only; BM_Simulation covers release.
+  cyclus::TestContext tc;
+  BenchConditioning* fac = new BenchConditioning(tc.get(), state);
+  fac->EnterNotify();
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    fac->Drain();
+    fac->Receive(Batches(state));
+    state.ResumeTiming();
+
+    fac->Tock();
+  }
+  ReportPerMaterial(state, state.range(0));
+  delete fac;
+}
+
+void BM_AcceptMatlTrades(benchmark::State& state) {
+  cyclus::TestContext tc;
+  BenchConditioning* fac = new BenchConditioning(tc.get(), state);
+  fac->EnterNotify();
+  fac->Tick();
+
+  std::set<RequestPortfolio<Material>::Ptr> ports =
+      fac->buyer().GetMatlRequests();
+  Request<Material>* req = (*ports.begin())->requests().front();
+  Material::Ptr offer = Material::CreateUntracked(state.range(1), WasteComp());
+  Bid<Material>* bid = Bid<Material>::Create(req, offer, &fac->seller());
+
+  std::vector<std::pair<Trade<Material>, Material::Ptr> > resps;
+  for (auto _ : state) {
+    state.PauseTiming();
+    fac->Drain();
+    resps.clear();
+    std::vector<Material::Ptr> mats = Batches(state);
+    for (int i = 0; i < mats.size(); ++i) {
+      Trade<Material> trade(req, bid, mats[i]->quantity());
+      resps.push_back(std::make_pair(trade, mats[i]));
+    }
+    state.ResumeTiming();
+
+    fac->buyer().AcceptMatlTrades(resps);
+  }
+  ReportPerMaterial(state, state.range(0));
+  delete bid;
+  delete fac;
+}
+
+void BM_GetMatlTrades(benchmark::State& state) {
+  cyclus::TestContext tc;
+  BenchConditioning* fac = new BenchConditioning(tc.get(), state);
+  fac->EnterNotify();
+
+  Material::Ptr target = Material::CreateUntracked(state.range(1), WasteComp());
+  Request<Material>* req =
+      Request<Material>::Create(target, &fac->buyer(), "packaged_waste");
+  Bid<Material>* bid = Bid<Material>::Create(req, target, &fac->seller());
+  std::vector<Trade<Material> > trades(state.range(0),
+                                       Trade<Material>(req, bid,
+                                                       state.range(1)));
+
+  std::vector<std::pair<Trade<Material>, Material::Ptr> > resps;
+  for (auto _ : state) {
+    state.PauseTiming();
+    fac->Drain();
+    fac->Stock(Batches(state));
+    resps.clear();
+    state.ResumeTiming();
+
+    fac->seller().GetMatlTrades(trades, resps);
+  }
+  ReportPerMaterial(state, state.range(0));
+  delete bid;
+  delete req;
+  delete fac;
+}
+
+void BM_Simulation(benchmark::State& state) {
+  int residence_time = state.range(2);
+  int duration = 2 * residence_time + 10;
+
+  std::stringstream config;
+  config << "<in_commods><val>waste</val></in_commods>"
+         << "<out_commods><val>packaged_waste</val></out_commods>"
+         << "<residence_time>" << residence_time << "</residence_time>"
+         << "<discrete_handling>" << state.range(4) << "</discrete_handling>";
+  if (state.range(3) > 0) {
+    config << "<throughput>" << state.range(3) << "</throughput>";
+  }
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    cyclus::MockSim sim(cyclus::AgentSpec(":cyder:Conditioning"),
+                        config.str(), duration);
+    sim.AddRecipe("waste_recipe", WasteComp());
+    for (int i = 0; i < state.range(0); ++i) {
+      sim.AddSource("waste")
+          .recipe("waste_recipe")
+          .capacity(state.range(1))
+          .Finalize();
+    }
+    sim.AddSink("packaged_waste").Finalize();
+    state.ResumeTiming();
+
+    sim.Run();
+  }
+  ReportPerMaterial(state, state.range(0) * duration);
+}
+
+// materials, batch_size, residence_time, throughput, discrete
+#define CYDER_DIRECT_ARGS                   \
+  Args({1, 100, 0, 0, 1})                   \
+      ->Args({1000, 100, 0, 0, 1})          \
+      ->Args({10000, 100, 0, 0, 1})         \
+      ->Args({10000, 100, 0, 50000, 1})     \
+      ->Args({10000, 100, 0, 50000, 0})     \
+      ->Args({10000, 100, 120, 0, 1})       \
+      ->Args({50000, 10, 0, 0, 1})
+
+BENCHMARK(BM_Tick)->CYDER_DIRECT_ARGS;
+BENCHMARK(BM_Tock)->CYDER_DIRECT_ARGS;
+BENCHMARK(BM_AcceptMatlTrades)->CYDER_DIRECT_ARGS;
+BENCHMARK(BM_GetMatlTrades)->CYDER_DIRECT_ARGS;
+
+BENCHMARK(BM_Simulation)
+    ->Args({1, 100, 0, 0, 1})
+    ->Args({10, 100, 12, 0, 1})
+    ->Args({10, 100, 120, 500, 1})
+    ->Args({10, 100, 120, 500, 0})
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace conditioning
+
+int main(int argc, char* argv[]) {
+  cyclus::Logger::ReportLevel() = cyclus::LEV_ERROR;
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -0,0 +1,356 @@
+#! /usr/bin/env python
+"""Output database size and write-throughput benchmark for Cyder scenarios.
+
+Reports the rows and bytes each table of a cyclus output database holds,
+and how many of them belong to each Conditioning agent, for SQLite and
+HDF5 databases. Tables are read a row (SQLite) or a chunk (HDF5) at a time,
+never whole, so databases much larger than memory can be analyzed.
+
+Analyze existing databases::
+
+    $ python output_size.py analyze run.sqlite run.h5
+
+or generate and run the decks of tests/scaling.py over archetype settings,
+timing each run and analyzing its output::
+
+    $ python output_size.py bench -n 10 100 -m 120 --discrete 1 0 \\
+          --throughput 0 500 --format sqlite h5 -o output_size.csv
+
+Rows are attributed to a Conditioning agent by its AgentId, SenderId or
+ReceiverId column. Resources rows have none of these: a resource belongs to
+the Conditioning agent that received it in a transaction, and so does every
+resource made from it (splits, merges, transmutations) until it is traded
+away.
+
+Conditioning agents are found by the Spec column of AgentEntry. HDF5
+databases that store it as a variable-length string cannot be searched
+this way; pass the agent ids with --conditioning instead. The bench command
+reuses the ids found in the SQLite run of the same deck, as agent ids do not
+depend on the backend.
+
+Each point of a bench scan also gets an "(all)" row with the total rows and
+bytes written, which with wall_time gives the write throughput.
+"""
+from __future__ import print_function
+
+import argparse
+import csv
+import os
+import sqlite3
+import sys
+import tempfile
+
+import scaling
+
+AGENT_COLUMNS = ["AgentId", "SenderId", "ReceiverId"]
+
+FIELDS = ["facilities", "timesteps", "discrete", "throughput", "format",
+          "wall_time", "db_size", "table", "agent", "rows", "bytes"]
+
+# rows read from an HDF5 table at a time
+CHUNK = 100000
+
+
+def value_size(val):
+    """Bytes SQLite needs to store val, roughly."""
+    if val is None:
+        return 0
+    elif isinstance(val, (bytes, bytearray, memoryview)):
+        return len(val)
+    elif isinstance(val, str):
+        return len(val.encode("utf-8"))
+    return 8
+
+
+class Report(object):
+    """Rows and bytes per table, in total and per Conditioning agent."""
+
+    def __init__(self):
+        self.tables = {}
+        self.agents = {}
+        self.conditioning = set()
+
+    def add(self, table, rows, nbytes, agent=None):
+        key = (table, agent)
+        store = self.tables if agent is None else self.agents
+        r, b = store.get(key, (0, 0))
+        store[key] = (r + rows, b + nbytes)
+
+    def rows(self):
+        """(table, agent, rows, bytes) tuples, totals first."""
+        out = [("(all)", "", sum(r for r, _ in self.tables.values()),
+                sum(b for _, b in self.tables.values()))]
+        for store in (self.tables, self.agents):
+            for (table, agent), (r, b) in sorted(store.items(),
+                                                 key=lambda x: str(x[0])):
+                out.append((table, "" if agent is None else agent, r, b))
+        return out
+
+
+def owner_of(ids, owners, sent):
+    """Propagates Conditioning ownership from parent to child resources."""
+    rid, p1, p2 = ids
+    if rid in owners:
+        return owners[rid]
+    for p in (p1, p2):
+        if p in owners and p not in sent:
+            return owners[p]
+    return None
+
+
+# ---------------------------------------------------------------------------
+# SQLite
+# ---------------------------------------------------------------------------
+
+def sqlite_conditioning(conn):
+    return set(r[0] for r in conn.execute(
+        "SELECT AgentId FROM AgentEntry WHERE Spec LIKE '%Conditioning%'"))
+
+
+def sqlite_table_bytes(conn):
+    """On-disk bytes per table from the dbstat virtual table, if built in."""
+    try:
+        return dict(conn.execute(
+            "SELECT name, SUM(pgsize) FROM dbstat GROUP BY name"))
+    except sqlite3.OperationalError:
+        return None
+
+
+def analyze_sqlite(path, report, conds=None):
+    conn = sqlite3.connect(path)
+    if conds is None:
+        conds = sqlite_conditioning(conn)
+    report.conditioning = conds
+    disk = sqlite_table_bytes(conn)
+    tables = [r[0] for r in conn.execute(
+        "SELECT name FROM sqlite_master WHERE type='table'")]
+
+    # resources traded to and from Conditioning agents
+    owners = {}
+    sent = set()
+    for rid, snd, rcv in conn.execute(
+            "SELECT ResourceId, SenderId, ReceiverId FROM Transactions"):
+        if rcv in conds:
+            owners[rid] = rcv
+        if snd in conds:
+            sent.add(rid)
+
+    for table in tables:
+        cols = [r[1] for r in conn.execute(
+            "PRAGMA table_info('{0}')".format(table))]
+        agent_cols = [cols.index(c) for c in AGENT_COLUMNS if c in cols]
+        is_res = table == "Resources"
+        if is_res:
+            id_cols = [cols.index(c) for c in
+                       ("ResourceId", "Parent1", "Parent2")]
+
+        rows = 0
+        nbytes = 0
+        # a row at a time, with the cursor as the iterator
+        for row in conn.execute("SELECT * FROM '{0}'".format(table)):
+            size = sum(value_size(v) for v in row)
+            rows += 1
+            nbytes += size
+            agents = set(row[i] for i in agent_cols if row[i] in conds)
+            if is_res:
+                owner = owner_of([row[i] for i in id_cols], owners, sent)
+                if owner is not None:
+                    owners[row[id_cols[0]]] = owner
+                    agents.add(owner)
+            for a in agents:
+                report.add(table, 1, size, a)
+        if disk is not None and table in disk:
+            nbytes = disk[table]
+        report.add(table, rows, nbytes)
+    conn.close()
+
+
+# ---------------------------------------------------------------------------
+# HDF5
+# ---------------------------------------------------------------------------
+
+def chunks(table, names):
+    """Yields dicts of column arrays, CHUNK rows at a time."""
+    for start in range(0, table.nrows, CHUNK):
+        stop = min(start + CHUNK, table.nrows)
+        data = table.read(start, stop)
+        yield dict((n, data[n]) for n in names)
+
+
+def h5_conditioning(f):
+    entry = f.get_node("/AgentEntry")
+    if entry.coldtypes["Spec"].kind != "S":
+        sys.stderr.write("warning: Spec is not stored as a fixed-length "
+                         "string, pass the Conditioning agent ids with "
+                         "--conditioning to attribute rows to agents\n")
+        return set()
+    conds = set()
+    for data in chunks(entry, ["AgentId", "Spec"]):
+        for aid, spec in zip(data["AgentId"], data["Spec"]):
+            if b"Conditioning" in spec:
+                conds.add(int(aid))
+    return conds
+
+
+def analyze_h5(path, report, conds=None):
+    import numpy as np
+    import tables as tb
+
+    with tb.open_file(path, mode="r") as f:
+        if conds is None:
+            conds = h5_conditioning(f)
+        report.conditioning = conds
+        cond_ids = np.array(sorted(conds), dtype=np.int64)
+
+        owners = {}
+        sent = set()
+        if "/Transactions" in f:
+            for data in chunks(f.get_node("/Transactions"),
+                               ["ResourceId", "SenderId", "ReceiverId"]):
+                for rid, snd, rcv in zip(data["ResourceId"],
+                                         data["SenderId"],
+                                         data["ReceiverId"]):
+                    if rcv in conds:
+                        owners[int(rid)] = int(rcv)
+                    if snd in conds:
+                        sent.add(int(rid))
+
+        for table in f.walk_nodes("/", classname="Table"):
+            name = table._v_pathname.lstrip("/")
+            report.add(name, table.nrows, table.size_on_disk)
+            names = table.colnames
+            agent_cols = [c for c in AGENT_COLUMNS if c in names]
+            is_res = name == "Resources"
+            if not agent_cols and not is_res:
+                continue
+            wanted = agent_cols + (["ResourceId", "Parent1", "Parent2"]
+                                   if is_res else [])
+            for data in chunks(table, wanted):
+                if is_res:
+                    found = []
+                    for ids in zip(data["ResourceId"], data["Parent1"],
+                                   data["Parent2"]):
+                        ids = [int(i) for i in ids]
+                        owner = owner_of(ids, owners, sent)
+                        if owner is not None:
+                            owners[ids[0]] = owner
+                        found.append(-1 if owner is None else owner)
+                    hits = [np.asarray(found)]
+                else:
+                    hits = []
+                hits += [data[c] for c in agent_cols]
+                for aid in cond_ids:
+                    n = int(np.any([h == aid for h in hits], axis=0).sum())
+                    if n:
+                        report.add(name, n, n * table.rowsize, int(aid))
+
+
+def analyze(path, conds=None):
+    """Returns the Report of a database. conds are the ids of the
+    Conditioning agents, found from AgentEntry if None."""
+    report = Report()
+    if path.endswith(".h5"):
+        analyze_h5(path, report, conds)
+    else:
+        analyze_sqlite(path, report, conds)
+    return report
+
+
+# ---------------------------------------------------------------------------
+# command line
+# ---------------------------------------------------------------------------
+
+def cmd_analyze(args):
+    out = open(args.output, "w") if args.output else sys.stdout
+    conds = set(args.conditioning) if args.conditioning else None
+    writer = csv.writer(out)
+    writer.writerow(["database", "table", "agent", "rows", "bytes"])
+    for path in args.databases:
+        for row in analyze(path, conds).rows():
+            writer.writerow([path] + list(row))
+    if out is not sys.stdout:
+        out.close()
+
+
+def cmd_bench(args):
+    workdir = args.keep or tempfile.mkdtemp(prefix="cyder-output-size-")
+    if not os.path.isdir(workdir):
+        os.makedirs(workdir)
+
+    with open(args.output, "w") as f:
+        writer = csv.writer(f)
+        writer.writerow(FIELDS)
+        for n in args.facilities:
+            for m in args.timesteps:
+                for discrete in args.discrete:
+                    for tp in args.throughput:
+                        name = "output_n{0}_m{1}_d{2}_t{3:g}".format(
+                            n, m, discrete, tp)
+                        infile = os.path.join(workdir, name + ".xml")
+                        with open(infile, "w") as deckfile:
+                            deckfile.write(scaling.deck(
+                                n, m, args.batch_size, args.residence_time,
+                                discrete, args.cycle_time,
+                                tp if tp > 0 else None))
+                        conds = None
+                        for fmt in sorted(args.format, reverse=True):
+                            outfile = os.path.join(workdir, name + "." + fmt)
+                            wall, _ = scaling.run(args.cyclus, infile,
+                                                  outfile)
+                            size = os.path.getsize(outfile)
+                            point = [n, m, discrete, tp, fmt, "%.3f" % wall,
+                                     size]
+                            report = analyze(outfile, conds)
+                            if fmt == "sqlite":
+                                conds = report.conditioning
+                            for row in report.rows():
+                                writer.writerow(point + list(row))
+                            f.flush()
+                            print(", ".join(str(x) for x in point))
+                            if args.keep is None:
+                                os.remove(outfile)
+                        if args.keep is None:
+                            os.remove(infile)
+    if args.keep is None:
+        os.rmdir(workdir)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    sub = parser.add_subparsers(dest="command")
+
+    a = sub.add_parser("analyze", help="report rows and bytes of databases")
+    a.add_argument("databases", nargs="+")
+    a.add_argument("--conditioning", type=int, nargs="+", default=None,
+                   help="ids of the Conditioning agents")
+    a.add_argument("-o", "--output", default=None,
+                   help="CSV file, standard output by default")
+
+    b = sub.add_parser("bench", help="run decks and report their output")
+    b.add_argument("-n", "--facilities", type=int, nargs="+", default=[10])
+    b.add_argument("-m", "--timesteps", type=int, nargs="+", default=[120])
+    b.add_argument("--discrete", type=int, nargs="+", default=[1, 0],
+                   help="discrete_handling values")
+    b.add_argument("--throughput", type=float, nargs="+", default=[0],
+                   help="conditioning throughputs (kg), 0 for the default")
+    b.add_argument("-b", "--batch-size", type=float, default=1000.)
+    b.add_argument("-r", "--residence-time", type=int, default=12)
+    b.add_argument("--cycle-time", type=int, default=1)
+    b.add_argument("--format", nargs="+", choices=["sqlite", "h5"],
+                   default=["sqlite", "h5"])
+    b.add_argument("--cyclus", default="cyclus")
+    b.add_argument("--keep", metavar="DIR", default=None,
+                   help="write decks and databases to DIR and keep them")
+    b.add_argument("-o", "--output", default="output_size.csv")
+
+    args = parser.parse_args()
+    if args.command == "analyze":
+        cmd_analyze(args)
+    elif args.command == "bench":
+        cmd_bench(args)
+    else:
+        parser.print_help()
+
+
+if __name__ == "__main__":
+    main()
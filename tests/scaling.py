@@ -0,0 +1,174 @@
+#! /usr/bin/env python
+"""Scenario scaling benchmark for the Conditioning archetype.
+
+Generates synthetic Source -> Reactor -> Conditioning -> Sink input decks
+with N conditioning facilities, as many reactors feeding them, and M
+timesteps, runs cyclus on each one and records the wall time, the peak
+resident set size of the cyclus process and the size of the output
+database in a CSV file.
+
+Example, scanning facility counts at the sizes of production runs::
+
+    $ python scaling.py -n 10 100 1000 -m 1200 -o scaling.csv
+
+Every point in the scan is run --repeat times, one CSV row per run, so
+super-linear growth in any column shows up when plotted against
+facilities * timesteps.
+"""
+from __future__ import print_function
+
+import argparse
+import csv
+import os
+import subprocess
+import tempfile
+import time
+
+ARCHETYPES = [("agents", "NullRegion"), ("agents", "NullInst"),
+              ("cycamore", "Source"), ("cycamore", "Reactor"),
+              ("cycamore", "Sink"), ("cyder", "Conditioning")]
+
+RECIPES = {
+    "fresh_uox": [("U235", 0.711), ("U238", 99.289)],
+    "spent_uox": [("Kr85", 50), ("Cs137", 50)],
+}
+
+FIELDS = ["facilities", "timesteps", "batch_size", "residence_time",
+          "discrete", "run", "wall_time", "max_rss_kb", "db_size"]
+
+
+def vals(values):
+    return "".join("<val>{0}</val>".format(v) for v in values)
+
+
+def facility(name, archetype, params):
+    config = "".join("<{0}>{1}</{0}>".format(k, v) for k, v in params)
+    return ("<facility><name>{0}</name><config><{1}>{2}</{1}></config>"
+            "</facility>").format(name, archetype, config)
+
+
+def recipe(name, nucs):
+    comps = "".join("<nuclide><id>{0}</id><comp>{1}</comp></nuclide>".format(
+        nuc, comp) for nuc, comp in nucs)
+    return "<recipe><name>{0}</name><basis>mass</basis>{1}</recipe>".format(
+        name, comps)
+
+
+def deck(facilities, timesteps, batch_size, residence_time, discrete,
+         cycle_time, throughput=None):
+    """Returns the input deck for one point of the scan as a string. The
+    conditioning throughput is left at its default if throughput is None."""
+    specs = "".join("<spec><lib>{0}</lib><name>{1}</name></spec>".format(
+        lib, name) for lib, name in ARCHETYPES)
+    protos = [
+        facility("source", "Source", [("outcommod", "fuel"),
+                                      ("outrecipe", "fresh_uox")]),
+        facility("reactor", "Reactor", [
+            ("assem_size", batch_size),
+            ("cycle_time", cycle_time),
+            ("fuel_incommods", vals(["fuel"])),
+            ("fuel_inrecipes", vals(["fresh_uox"])),
+            ("fuel_outcommods", vals(["spent_uox"])),
+            ("fuel_outrecipes", vals(["spent_uox"])),
+            ("n_assem_batch", 1),
+            ("n_assem_core", 1),
+            ("power_cap", 1),
+            ("refuel_time", 0)]),
+        facility("conditioning", "Conditioning", [
+            ("in_commods", vals(["spent_uox"])),
+            ("out_commods", vals(["packaged_spent_uox"])),
+            ("residence_time", residence_time),
+            ("discrete_handling", int(discrete))] +
+            ([] if throughput is None else [("throughput", throughput)])),
+        facility("sink", "Sink", [
+            ("in_commods", vals(["packaged_spent_uox"]))]),
+    ]
+    counts = [("source", 1), ("reactor", facilities),
+              ("conditioning", facilities), ("sink", 1)]
+    entries = "".join(
+        "<entry><prototype>{0}</prototype><number>{1}</number></entry>".format(
+            proto, n) for proto, n in counts)
+    region = ("<region><name>region</name><config><NullRegion/></config>"
+              "<institution><name>inst</name>"
+              "<initialfacilitylist>{0}</initialfacilitylist>"
+              "<config><NullInst/></config></institution></region>").format(
+                  entries)
+    control = ("<control><duration>{0}</duration><startmonth>1</startmonth>"
+               "<startyear>2000</startyear></control>").format(timesteps)
+    return "<simulation>{0}{1}{2}{3}{4}</simulation>\n".format(
+        control, "<archetypes>" + specs + "</archetypes>", "".join(protos),
+        region, "".join(recipe(k, v) for k, v in sorted(RECIPES.items())))
+
+
+def run(cyclus, infile, outfile):
+    """Runs cyclus once, returns (wall time in s, peak RSS in kB)."""
+    if os.path.exists(outfile):
+        os.remove(outfile)
+    with open(os.devnull, "w") as devnull:
+        start = time.time()
+        proc = subprocess.Popen([cyclus, infile, "-o", outfile],
+                                stdout=devnull, stderr=subprocess.STDOUT)
+        _, status, usage = os.wait4(proc.pid, 0)
+        wall = time.time() - start
+    if status != 0:
+        raise RuntimeError("cyclus failed on " + infile)
+    return wall, usage.ru_maxrss
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("-n", "--facilities", type=int, nargs="+",
+                        default=[1, 10, 100], help="conditioning facilities")
+    parser.add_argument("-m", "--timesteps", type=int, nargs="+",
+                        default=[120], help="simulation durations")
+    parser.add_argument("-b", "--batch-size", type=float, nargs="+",
+                        default=[1000.], help="reactor assembly mass (kg)")
+    parser.add_argument("-r", "--residence-time", type=int, default=12)
+    parser.add_argument("--cycle-time", type=int, default=1,
+                        help="timesteps between reactor discharges")
+    parser.add_argument("--continuous", action="store_true",
+                        help="use continuous instead of discrete handling")
+    parser.add_argument("--repeat", type=int, default=1)
+    parser.add_argument("--format", choices=["sqlite", "h5"],
+                        default="sqlite", help="output database format")
+    parser.add_argument("--cyclus", default="cyclus",
+                        help="cyclus executable")
+    parser.add_argument("--keep", metavar="DIR", default=None,
+                        help="write decks and databases to DIR and keep them")
+    parser.add_argument("-o", "--output", default="scaling.csv")
+    args = parser.parse_args()
+
+    workdir = args.keep or tempfile.mkdtemp(prefix="cyder-scaling-")
+    if not os.path.isdir(workdir):
+        os.makedirs(workdir)
+
+    with open(args.output, "w") as f:
+        writer = csv.writer(f)
+        writer.writerow(FIELDS)
+        for n in args.facilities:
+            for m in args.timesteps:
+                for b in args.batch_size:
+                    name = "scaling_n{0}_m{1}_b{2:g}".format(n, m, b)
+                    infile = os.path.join(workdir, name + ".xml")
+                    outfile = os.path.join(workdir, name + "." + args.format)
+                    with open(infile, "w") as deckfile:
+                        deckfile.write(deck(n, m, b, args.residence_time,
+                                            not args.continuous,
+                                            args.cycle_time))
+                    for i in range(args.repeat):
+                        wall, rss = run(args.cyclus, infile, outfile)
+                        row = [n, m, b, args.residence_time,
+                               int(not args.continuous), i, "%.3f" % wall,
+                               rss, os.path.getsize(outfile)]
+                        writer.writerow(row)
+                        f.flush()
+                        print(", ".join(str(x) for x in row))
+                    if args.keep is None:
+                        os.remove(infile)
+                        os.remove(outfile)
+    if args.keep is None:
+        os.rmdir(workdir)
+
+
+if __name__ == "__main__":
+    main()